@@ -13,162 +13,118 @@
  * You should have received a copy of the GNU General Public License
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
+#include <algorithm>
 #include <cmath>
 #include <cstdio>
 #include <err.h>
 #include <getopt.h>
 #include <iostream>
+#include <limits>
 #include <string>
-#include <unordered_map>
 #include <vector>
 #include "matrix.h"
 
-matrix parse_tolerant_internal(const std::string &file_name,
-							   std::istream *input);
+enum class combine_mode { best, mean };
 
 /**
- * @brief A vector maps an index to a value. Invert this relation.
+ * @brief Combine many matrices into one. Only the names common to all
+ * matrices are kept, in the order of the first matrix. If all matrices come
+ * with coverages, each cell is taken from the matrix with the highest
+ * coverage, or is the coverage-weighted mean. Otherwise the maximum is used;
+ * the mean is an error then.
  *
- * @returns An unordered map with inverse relationship.
+ * @param matrices - The matrices to combine.
+ * @param mode - How to use the coverages.
+ * @returns the combined matrix.
  */
-template <typename T>
-auto make_index_map(const std::vector<T> &container)
-	-> std::unordered_map<T, size_t>
+matrix combine(const std::vector<matrix> &matrices, combine_mode mode)
 {
-	auto ret = std::unordered_map<T, size_t>{};
-	ret.reserve(container.size());
-	for (size_t i = 0; i < container.size(); ++i) {
-		ret[container[i]] = i;
+	const auto &first_names = matrices[0].get_names();
+	auto sorted_names =
+		std::vector<std::string>(first_names.begin(), first_names.end());
+	std::sort(sorted_names.begin(), sorted_names.end());
+	for (const auto &mat : matrices) {
+		sorted_names = common_names(sorted_names, mat.get_names());
 	}
-	return ret;
-}
-
-matrix combine(const matrix &self, const matrix &other)
-{
-	auto this_map = make_index_map(self.get_names());
-	auto other_map = make_index_map(other.get_names());
 
-	auto common_names = std::vector<std::string>{};
-	for (const auto &name : self.get_names()) {
-		if (other_map.find(name) != other_map.end()) {
-			common_names.push_back(name);
+	auto names = std::vector<std::string>{};
+	for (auto name : first_names) {
+		if (std::binary_search(sorted_names.begin(), sorted_names.end(),
+							   name)) {
+			names.emplace_back(name);
 		}
 	}
 
-	auto size = common_names.size();
-	auto ret = matrix(common_names, std::vector<double>(size * size));
-
-	for (size_t i = 0; i < common_names.size() - 1; i++) {
-		auto name1 = common_names[i];
-		for (size_t j = i + 1; j < common_names.size(); j++) {
-			auto name2 = common_names[j];
-			auto d1 = self.entry(this_map[name1], this_map[name2]);
-			auto d2 = other.entry(other_map[name1], other_map[name2]);
-
-			if (self.has_coverages() && other.has_coverages()) {
-				auto c1 = self.cov_entry(this_map[name1], this_map[name2]);
-				auto c2 = other.cov_entry(other_map[name1], other_map[name2]);
-
-				auto val = c1 > c2 ? d1 : d2;
-				// auto val = (d1 * c1 + d2 * c2 ) / (c1 + c2);
+	// translate the names once, instead of for every cell
+	auto index_maps = std::vector<std::vector<size_t>>{};
+	for (const auto &mat : matrices) {
+		index_maps.push_back(indices_of(mat, names.begin(), names.end()));
+	}
 
-				ret.entry(i, j) = ret.entry(j, i) = val;
-			} else {
-				ret.entry(i, j) = ret.entry(j, i) = std::max(d1, d2);
-			}
+	auto has_coverages = [](const matrix &mat) { return mat.has_coverages(); };
+	auto with_coverages =
+		std::all_of(matrices.begin(), matrices.end(), has_coverages);
+	if (!with_coverages) {
+		if (mode == combine_mode::mean) {
+			errx(1, "--mean needs coverages for every matrix.");
+		}
+		if (std::any_of(matrices.begin(), matrices.end(), has_coverages)) {
+			warnx("Not all matrices have coverages; using the maximum.");
 		}
 	}
 
-	return ret;
-}
-
-static void mat_combine_usage(int status);
-
-auto parse_line_without_name(const std::string &file_name, std::istream *input,
-							 size_t max_values)
-{
-	auto values = std::vector<double>{};
-
-	while (max_values-- > 0) {
-		auto str = std::string();
-		auto value = 0.0;
-
-		*input >> str;
-		try {
-			value = std::stod(str); // also parses nan
-		} catch (std::exception &e) {
-			/* If error is recoverable, reset. This happens when we read past
-			 * the end of a line and tried to interpret the next name as a value
-			 * instead.
-			 */
-			if (input->fail()) {
-				input->clear();
-			}
-
-			input->putback(' ');
-			// not a double, probably a name. push back
-			for (auto it = str.crbegin(); it != str.crend(); it++) {
-				input->putback(*it);
+	auto size = names.size();
+	auto count = matrices.size();
+	auto values = std::vector<double>(size * size);
+
+#pragma omp parallel for schedule(dynamic, 16)
+	for (size_t i = 1; i < size; i++) {
+		for (size_t j = 0; j < i; j++) {
+			auto val = 0.0;
+
+			if (!with_coverages) {
+				val = -std::numeric_limits<double>::infinity();
+				for (size_t m = 0; m < count; m++) {
+					const auto &index_map = index_maps[m];
+					val = std::max(
+						val, matrices[m].entry(index_map[i], index_map[j]));
+				}
+			} else if (mode == combine_mode::best) {
+				auto best_coverage = -std::numeric_limits<double>::infinity();
+				for (size_t m = 0; m < count; m++) {
+					const auto &index_map = index_maps[m];
+					auto c = matrices[m].cov_entry(index_map[i], index_map[j]);
+					if (c >= best_coverage) {
+						best_coverage = c;
+						val = matrices[m].entry(index_map[i], index_map[j]);
+					}
+				}
+			} else {
+				auto sum = 0.0, weighted_sum = 0.0, coverage_sum = 0.0;
+				for (size_t m = 0; m < count; m++) {
+					const auto &index_map = index_maps[m];
+					auto d = matrices[m].entry(index_map[i], index_map[j]);
+					auto c = matrices[m].cov_entry(index_map[i], index_map[j]);
+					sum += d;
+					weighted_sum += d * c;
+					coverage_sum += c;
+				}
+				// without any coverage, fall back to the plain mean
+				val = coverage_sum > 0 ? weighted_sum / coverage_sum
+									   : sum / count;
 			}
 
-			input->putback(' ');
-			break; // out of the loop
+			values[i * size + j] = values[j * size + i] = val;
 		}
-
-		values.push_back(value);
 	}
 
-	return values;
+	return matrix(names, values);
 }
 
-template <typename OutputIt>
-OutputIt parse_tolerant_with_coverage(const std::string &file_name,
-									  OutputIt out)
-{
-	std::ifstream file;
-	std::istream *input = &std::cin;
-
-	if (file_name != "-") {
-		file = std::ifstream{file_name};
-		input = &file;
-	}
-
-	if (!input || !*input) {
-		err(errno, "%s", file_name.c_str());
-	}
-
-	const auto skip_blank_lines = [](std::istream *input) {
-		while (input->peek() == '\n') {
-			input->get();
-		}
-	};
-
-	if (skip_blank_lines(input), (input->good() && !input->eof())) {
-		auto distance_matrix = parse_tolerant_internal(file_name, input);
-
-		auto size = distance_matrix.get_size();
-		auto coverages = std::vector<double>(size * size);
-		skip_blank_lines(input);
-
-		auto dummy = std::string();
-		*input >> dummy; // "Coverages:"
-
-		for (size_t i = 0; i < size; i++) {
-			auto values = parse_line_without_name(file_name, input, size);
-
-			std::copy(values.begin(), values.end(),
-					  coverages.begin() + (i * size));
-		}
-
-		*out++ = matrix(distance_matrix.get_names(),
-						distance_matrix.get_values(), coverages);
-	}
-
-	return out;
-}
+static void mat_combine_usage(int status);
 
 /**
- * @brief The main function of `mat compare`.
+ * @brief The main function of `mat combine`.
  *
  * @param argc - It's argc, stupid. (Advanced by one from global argc.)
  * @param argv - It's argv, stupid. (Advanced by one from global argv.)
@@ -178,14 +134,15 @@ int mat_combine(int argc, char **argv)
 {
 	static struct option long_options[] = {
 		{"help", no_argument, 0, 0}, // print help
-		{0, 0, 0, 0}				 //
+		{"mean", no_argument, 0, 'm'},
+		{0, 0, 0, 0} //
 	};
 
-	bool full_matrix = false;
+	auto mode = combine_mode::best;
 
 	while (true) {
 		int long_index;
-		int c = getopt_long(argc, argv, "f", long_options, &long_index);
+		int c = getopt_long(argc, argv, "m", long_options, &long_index);
 
 		if (c == -1) {
 			break;
@@ -193,6 +150,8 @@ int mat_combine(int argc, char **argv)
 
 		if (c == 0 && std::string(long_options[long_index].name) == "help") {
 			mat_combine_usage(EXIT_SUCCESS);
+		} else if (c == 'm') {
+			mode = combine_mode::mean;
 		} else {
 			mat_combine_usage(EXIT_FAILURE);
 		}
@@ -200,24 +159,13 @@ int mat_combine(int argc, char **argv)
 
 	argc -= optind, argv += optind; // hack
 
-	// auto matrices = parse_all(argv);
-	auto file_names = std::vector<std::string>(argv, argv + argc);
-
-	// check for STDIN
-
-	auto matrices = std::vector<matrix>();
-	auto inserter = std::back_inserter(matrices);
-	matrices.reserve(file_names.size());
-
-	for (const auto &file_name : file_names) {
-		parse_tolerant_with_coverage(file_name, inserter);
-	}
+	auto matrices = parse_all(argv);
 
 	if (matrices.size() < 2) {
 		errx(1, "At least two matrices must be provided.");
 	}
 
-	std::cout << combine(matrices[0], matrices[1]).to_string() << std::endl;
+	std::cout << combine(matrices, mode).to_string();
 
 	return 0;
 }
@@ -226,8 +174,10 @@ static void mat_combine_usage(int status)
 {
 	static const char str[] = {
 		"usage: mat combine [OPTIONS] [FILE...]\n" // this comment is a hack
-		"Combine two distances matrices.\n\n"
+		"Combine distance matrices, using the entries with the highest\n"
+		"coverage, if given, or the maximum.\n\n"
 		"Available options:\n"
+		" -m, --mean          use the coverage-weighted mean instead\n"
 		"     --help          print this help\n"};
 
 	fprintf(status == EXIT_SUCCESS ? stdout : stderr, str);
@@ -14,7 +14,7 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 #include <algorithm>
-#include <array>
+#include <cassert>
 #include <cmath>
 #include <cstdio>
 #include <err.h>
@@ -24,245 +24,515 @@
 #include <string>
 #include <unordered_map>
 #include <vector>
+#include "compare.h"
 #include "matrix.h"
 
-namespace details
-{
-template <class>
-struct is_ref_wrapper : std::false_type {
-};
-template <class T>
-struct is_ref_wrapper<std::reference_wrapper<T>> : std::true_type {
-};
+/* The parts of the metrics are function objects, so they get inlined into the
+ * row kernels below, which can then be vectorized. */
 
-template <class T>
-using not_ref_wrapper = std::negation<is_ref_wrapper<std::decay_t<T>>>;
+struct just_Dij {
+	constexpr double operator()(double Dij, double) const
+	{
+		return Dij;
+	}
+};
 
-template <class D, class...>
-struct return_type_helper {
-	using type = D;
+struct just_Dij_squared {
+	constexpr double operator()(double Dij, double) const
+	{
+		return Dij * Dij;
+	}
 };
-template <class... Types>
-struct return_type_helper<void, Types...> : std::common_type<Types...> {
-	static_assert(std::conjunction_v<not_ref_wrapper<Types>...>,
-				  "Types cannot contain reference_wrappers when D is void");
+
+struct difference_squared {
+	constexpr double operator()(double Dij, double dij) const
+	{
+		return (Dij - dij) * (Dij - dij);
+	}
 };
 
-template <class D, class... Types>
-using return_type = std::array<typename return_type_helper<D, Types...>::type,
-							   sizeof...(Types)>;
-} // namespace details
+struct average_squared {
+	constexpr double operator()(double Dij, double dij) const
+	{
+		auto temp = (Dij + dij) / 2.0;
+		return temp * temp;
+	}
+};
 
-template <class D = void, class... Types>
-constexpr details::return_type<D, Types...> make_array(Types &&... t)
-{
-	return {std::forward<Types>(t)...};
-}
+struct just_average {
+	constexpr double operator()(double Dij, double dij) const
+	{
+		auto temp = (Dij + dij) / 2.0;
+		return temp;
+	}
+};
 
-// not exposed, yet
-double p1_norm(const matrix &self, const matrix &other)
-{
-	auto self_names = self.get_names();
-	auto other_names = other.get_names();
-	std::sort(self_names.begin(), self_names.end());
-	std::sort(other_names.begin(), other_names.end());
+struct just_one {
+	constexpr double operator()(double, double) const
+	{
+		return 1.0;
+	}
+};
 
-	if (!std::equal(self_names.begin(), self_names.end(), other_names.begin(),
-					other_names.end())) {
-		warnx("The matrices have different sets of names.");
+struct difference_abs {
+	constexpr double operator()(double Dij, double dij) const
+	{
+		auto temp = Dij - dij;
+		return temp < 0 ? -temp : temp;
 	}
+};
 
-	auto new_names = common_names(self_names, other_names);
+struct relative_difference {
+	constexpr double operator()(double Dij, double dij) const
+	{
+		auto temp = 2 * (Dij - dij) / (Dij + dij);
+		return temp < 0 ? -temp : temp;
+	}
+};
 
-	auto new_self = sample2(self, new_names.begin(), new_names.end());
-	auto new_other = sample2(other, new_names.begin(), new_names.end());
+/** @brief Reduce a segment of a row by summing up a function of both
+ * matrices. The segment is contiguous, so the loop is vectorized with
+ * multiple partial sums.
+ *
+ * @param self - The entries of one matrix.
+ * @param other - The corresponding entries of the other matrix.
+ * @param n - The number of entries.
+ * @returns the partial sum.
+ */
+template <class Numerator, class Denominator>
+double delta_row(const double *__restrict self,
+				 const double *__restrict other, size_t n)
+{
+	constexpr auto numerator_fn = Numerator{};
+	constexpr auto denominator_fn = Denominator{};
 
 	double dist = 0;
-	auto other_it = begin_lower_triangle(new_other);
+#pragma omp simd reduction(+ : dist)
+	for (size_t j = 0; j < n; j++) {
+		auto numerator = numerator_fn(self[j], other[j]);
+		auto denominator = denominator_fn(self[j], other[j]);
 
-	for (auto entry : lower_triangle(new_self)) {
-		dist += std::fabs(entry - *other_it++);
+		dist += numerator / denominator;
 	}
+	return dist;
+}
 
+double hausdorff_row(const double *__restrict self,
+					 const double *__restrict other, size_t n)
+{
+	constexpr auto difference_fn = difference_abs{};
+
+	double dist = 0;
+#pragma omp simd reduction(max : dist)
+	for (size_t j = 0; j < n; j++) {
+		auto difference = difference_fn(self[j], other[j]);
+		dist = dist < difference ? difference : dist;
+	}
 	return dist;
 }
 
-/**
- * @brief Treat two distance matrices as vectors and compute their euklidian
- * distance. To avoid errors from different arrangements, the set of common
- * names is computed first and then the corresponding sub matrices are used.
+double just_sum(double sum, double)
+{
+	return sum;
+}
+
+double average(double sum, double count)
+{
+	return sum / count;
+}
+
+/** @brief Sum up values by recursively adding both halves. The rounding error
+ * grows only logarithmically and, unlike a parallel reduction, the result
+ * does not depend on the number of threads.
  *
- * @param self - One matrix
- * @param other - The other matrix, duh.
- * @returns the euklidian distance.
+ * @param first - The first value.
+ * @param last - One past the last value.
+ * @returns the sum.
  */
-double p2_norm(const matrix &self, const matrix &other)
+double pairwise_sum(const double *first, const double *last)
 {
-	auto self_names = self.get_names();
-	auto other_names = other.get_names();
-	std::sort(self_names.begin(), self_names.end());
-	std::sort(other_names.begin(), other_names.end());
-
-	if (!std::equal(self_names.begin(), self_names.end(), other_names.begin(),
-					other_names.end())) {
-		warnx("The matrices have different sets of names.");
+	auto n = last - first;
+	if (n <= 8) {
+		return std::accumulate(first, last, 0.0);
 	}
 
-	auto new_names = common_names(self_names, other_names);
+	auto middle = first + n / 2;
+	return pairwise_sum(first, middle) + pairwise_sum(middle, last);
+}
 
-	auto new_self = sample2(self, new_names.begin(), new_names.end());
-	auto new_other = sample2(other, new_names.begin(), new_names.end());
+/** @brief A metric is computed row by row on the lower triangle. The results
+ * of all rows are either summed up or maximized. The final value is derived
+ * from that and the number of cells. Directed metrics depend on the order of
+ * the two matrices. */
+struct metric {
+	const char *name;
+	double (*row_fn)(const double *, const double *, size_t);
+	bool maximum;
+	double (*finalize)(double, double);
+	bool directed;
+};
 
-	double dist = 0;
-	auto other_it = begin_lower_triangle(new_other);
+static const metric metrics[] = {
+	{"delta1", delta_row<difference_squared, just_Dij_squared>, false,
+	 just_sum, true},
+	{"delta2", delta_row<difference_squared, average_squared>, false,
+	 just_sum, false},
+	{"delta3", delta_row<difference_squared, just_Dij>, false, just_sum,
+	 true},
+	{"delta4", delta_row<difference_squared, just_average>, false, just_sum,
+	 false},
+	{"delta5", delta_row<difference_abs, just_average>, false, just_sum,
+	 false},
+	{"rel", delta_row<relative_difference, just_one>, false, average, false},
+	{"delta6", delta_row<difference_squared, just_one>, false, just_sum,
+	 false},
+	{"hausdorff", hausdorff_row, true, just_sum, false},
+};
 
-	for (auto entry : lower_triangle(new_self)) {
-		auto d = entry - *other_it++;
-		dist += d * d;
+/**
+ * @brief Combine the results of all rows into the final values. This happens
+ * in a fixed order to get reproducible results.
+ *
+ * @param row_values - The result of row i for metric k at k * size + i.
+ * @param size - The size of the matrices.
+ * @param selected - The metrics to compute.
+ * @returns the value of each metric.
+ */
+std::vector<double> reduce_rows(const std::vector<double> &row_values,
+								size_t size,
+								const std::vector<const metric *> &selected)
+{
+	assert(size > 0);
+	auto ret = std::vector<double>(selected.size());
+	auto count = size * (size - 1) / 2;
+
+	for (size_t k = 0; k < selected.size(); k++) {
+		auto first = row_values.data() + k * size;
+		auto value = selected[k]->maximum
+						 ? *std::max_element(first, first + size)
+						 : pairwise_sum(first, first + size);
+		ret[k] = selected[k]->finalize(value, count);
 	}
 
-	auto n = new_names.size() * (new_names.size() - 1) / 2;
-
-	return std::sqrt(dist / n);
+	return ret;
 }
 
-double rel(const matrix &self, const matrix &other)
+/**
+ * @brief Compute several metrics on two aligned distance matrices in a single
+ * pass.
+ *
+ * @param new_self - One matrix
+ * @param new_other - The other matrix with the same names in the same order.
+ * @param selected - The metrics to compute.
+ * @returns the value of each metric.
+ */
+std::vector<double> compare(const matrix_view &new_self,
+							const matrix_view &new_other,
+							const std::vector<const metric *> &selected)
 {
-	auto self_names = self.get_names();
-	auto other_names = other.get_names();
-	std::sort(self_names.begin(), self_names.end());
-	std::sort(other_names.begin(), other_names.end());
+	assert(new_self.get_size() == new_other.get_size());
+	auto size = new_self.get_size();
+	auto row_values = std::vector<double>(selected.size() * size, 0.0);
+
+	// Rows are independent, so their order of evaluation does not matter.
+#pragma omp parallel
+	{
+		auto self_buffer = std::vector<double>(size);
+		auto other_buffer = std::vector<double>(size);
+
+#pragma omp for schedule(dynamic, 16)
+		for (size_t i = 1; i < size; i++) {
+			auto self_row = new_self.lower_row(i, self_buffer.data());
+			auto other_row = new_other.lower_row(i, other_buffer.data());
+
+			for (size_t k = 0; k < selected.size(); k++) {
+				row_values[k * size + i] =
+					selected[k]->row_fn(self_row, other_row, i);
+			}
+		}
+	}
 
-	if (!std::equal(self_names.begin(), self_names.end(), other_names.begin(),
-					other_names.end())) {
+	return reduce_rows(row_values, size, selected);
+}
+
+/**
+ * @brief Compute several metrics on two distance matrices in a single pass. To
+ * avoid errors from different arrangements, the set of common names is
+ * computed first and then only the corresponding submatrices are used.
+ *
+ * @param self - One matrix
+ * @param other - The other matrix, duh.
+ * @param selected - The metrics to compute.
+ * @returns the value of each metric.
+ */
+std::vector<double> compare(const matrix &self, const matrix &other,
+							const std::vector<const metric *> &selected)
+{
+	auto new_names = common_names(self.get_names(), other.get_names());
+	if (new_names.empty()) {
+		errx(1, "The matrices have no names in common.");
+	}
+	if (new_names.size() != self.get_size() ||
+		new_names.size() != other.get_size()) {
 		warnx("The matrices have different sets of names.");
 	}
 
-	auto new_names = common_names(self_names, other_names);
+	auto new_self = sample_view(self, new_names.begin(), new_names.end());
+	auto new_other = sample_view(other, new_names.begin(), new_names.end());
 
-	auto new_self = sample2(self, new_names.begin(), new_names.end());
-	auto new_other = sample2(other, new_names.begin(), new_names.end());
+	return compare(new_self, new_other, selected);
+}
 
-	double dist = 0;
-	auto other_it = begin_lower_triangle(new_other);
+/**
+ * @brief Compare the matrices of two files row by row in lockstep. This
+ * only needs memory for a single row but works only as long as both matrices
+ * list the same names in the same order.
+ *
+ * @param first_file_name - One file.
+ * @param second_file_name - The other file.
+ * @param selected - The metrics to compute.
+ * @param count - Set to the number of compared pairs of matrices.
+ * @param out - Called with the values of each pair of matrices.
+ * @returns false iff the orders of names diverged.
+ */
+template <typename Func>
+bool compare_streaming(const std::string &first_file_name,
+					   const std::string &second_file_name,
+					   const std::vector<const metric *> &selected,
+					   size_t &count, Func out)
+{
+	auto first = row_reader(first_file_name);
+	auto second = row_reader(second_file_name);
+
+	auto first_name = std::string(), second_name = std::string();
+	auto first_values = std::vector<double>();
+	auto second_values = std::vector<double>();
+
+	count = 0;
+	while (first.next_matrix() && second.next_matrix()) {
+		auto size = first.get_size();
+		if (second.get_size() != size) return false;
+
+		auto row_values = std::vector<double>(selected.size() * size, 0.0);
+		for (size_t i = 0; i < size; i++) {
+			first.next_row(first_name, first_values);
+			second.next_row(second_name, second_values);
+			if (first_name != second_name) return false;
+
+			for (size_t k = 0; k < selected.size(); k++) {
+				row_values[k * size + i] = selected[k]->row_fn(
+					first_values.data(), second_values.data(), i);
+			}
+		}
 
-	for (auto entry : lower_triangle(new_self)) {
-		auto d = 2 * (entry - *other_it);
-		auto f = entry + *other_it;
-		dist += std::abs(d / f);
-		other_it++;
+		out(reduce_rows(row_values, size, selected));
+		count++;
 	}
 
-	auto n = new_names.size() * (new_names.size() - 1) / 2;
-
-	return dist / n;
+	return true;
 }
 
-using function_type = double(double, double);
-
-template <function_type numerator_fn, function_type denominator_fn>
-double delta(const matrix &self, const matrix &other)
+/**
+ * @brief Compare all matrices with each other. All matrices are aligned to
+ * their common set of names once. Then the pairs are distributed among all
+ * threads. Symmetric metrics are computed once per unordered pair; directed
+ * ones for both orders.
+ *
+ * @param matrices - The matrices to compare.
+ * @param selected - The metrics to compute.
+ * @returns one matrix per metric.
+ */
+std::vector<matrix>
+compare_all_pairs(const std::vector<matrix> &matrices,
+				  const std::vector<const metric *> &selected)
 {
-	auto self_names = self.get_names();
-	auto other_names = other.get_names();
-	std::sort(self_names.begin(), self_names.end());
-	std::sort(other_names.begin(), other_names.end());
+	const auto &first_names = matrices[0].get_names();
+	auto names =
+		std::vector<std::string>(first_names.begin(), first_names.end());
+	std::sort(names.begin(), names.end());
+	for (const auto &mat : matrices) {
+		names = common_names(names, mat.get_names());
+	}
+	if (names.empty()) {
+		errx(1, "The matrices have no names in common.");
+	}
 
-	if (!std::equal(self_names.begin(), self_names.end(), other_names.begin(),
-					other_names.end())) {
-		warnx("The matrices have different sets of names.");
+	auto views = std::vector<matrix_view>();
+	views.reserve(matrices.size());
+	for (const auto &mat : matrices) {
+		if (mat.get_size() != names.size()) {
+			warnx("The matrices have different sets of names.");
+		}
+		views.push_back(sample_view(mat, names.begin(), names.end()));
+	}
+
+	auto directed = std::vector<const metric *>();
+	auto directed_index = std::vector<size_t>();
+	for (size_t k = 0; k < selected.size(); k++) {
+		if (selected[k]->directed) {
+			directed.push_back(selected[k]);
+			directed_index.push_back(k);
+		}
 	}
 
-	auto new_names = common_names(self_names, other_names);
+	// come up with a new name for each matrix
+	auto size = matrices.size();
+	auto matrix_names = std::vector<std::string>();
+	for (size_t i = 1; i <= size; i++) {
+		matrix_names.push_back(std::string("M") + std::to_string(i));
+	}
 
-	auto new_self = sample2(self, new_names.begin(), new_names.end());
-	auto new_other = sample2(other, new_names.begin(), new_names.end());
+	auto ret = std::vector<matrix>(
+		selected.size(),
+		matrix{matrix_names, std::vector<double>(size * size)});
 
-	double dist = 0;
-	auto other_it = begin_lower_triangle(new_other);
+	auto pairs = std::vector<std::pair<size_t, size_t>>();
+	pairs.reserve(size * (size - 1) / 2);
+	for (size_t i = 1; i < size; i++) {
+		for (size_t j = 0; j < i; j++) {
+			pairs.emplace_back(i, j);
+		}
+	}
 
-	for (auto entry : lower_triangle(new_self)) {
-		auto numerator = numerator_fn(entry, *other_it);
-		auto denominator = denominator_fn(entry, *other_it);
+#pragma omp parallel for schedule(dynamic)
+	for (size_t p = 0; p < pairs.size(); p++) {
+		auto i = pairs[p].first, j = pairs[p].second;
 
-		dist += numerator / denominator;
-		other_it++;
+		auto dists = compare(views[i], views[j], selected);
+		for (size_t k = 0; k < selected.size(); k++) {
+			ret[k].entry(i, j) = ret[k].entry(j, i) = dists[k];
+		}
+
+		if (!directed.empty()) {
+			auto reverse = compare(views[j], views[i], directed);
+			for (size_t k = 0; k < directed.size(); k++) {
+				ret[directed_index[k]].entry(j, i) = reverse[k];
+			}
+		}
 	}
 
-	return dist;
+	return ret;
 }
 
-double just_Dij(double Dij, double)
+/**
+ * @brief Find the k cells with the largest absolute difference between two
+ * aligned matrices. Each thread keeps a bounded heap of its own; these are
+ * merged at the end. Ties are broken by position, so the result does not
+ * depend on the number of threads.
+ *
+ * @param self - One matrix.
+ * @param other - The other matrix with the same names in the same order.
+ * @param k - The number of cells to report.
+ * @returns the cells from the lower triangle, largest difference first.
+ */
+std::vector<discrepancy> top_discrepancies(const matrix_view &self,
+										   const matrix_view &other, size_t k)
 {
-	return Dij;
-}
+	assert(self.get_size() == other.get_size());
+	auto size = self.get_size();
+
+	// true iff a ranks before b; differences that are not a number rank
+	// first, as they never compare
+	auto ranks_before = [](const discrepancy &a, const discrepancy &b) {
+		auto da = a.difference(), db = b.difference();
+		auto a_nan = std::isnan(da), b_nan = std::isnan(db);
+		if (a_nan != b_nan) return a_nan;
+		if (!a_nan && da != db) return da > db;
+		return a.i < b.i || (a.i == b.i && a.j < b.j);
+	};
 
-double just_Dij_squared(double Dij, double)
-{
-	return Dij * Dij;
-}
+	// there are only so many cells in the lower triangle
+	k = std::min(k, size * (size - 1) / 2);
+	auto ret = std::vector<discrepancy>();
+	if (k == 0) return ret;
+
+#pragma omp parallel
+	{
+		auto self_buffer = std::vector<double>(size);
+		auto other_buffer = std::vector<double>(size);
+		// the last ranking cell is at the front
+		auto heap = std::vector<discrepancy>();
+		heap.reserve(k);
+
+#pragma omp for schedule(dynamic, 16) nowait
+		for (size_t i = 1; i < size; i++) {
+			auto self_row = self.lower_row(i, self_buffer.data());
+			auto other_row = other.lower_row(i, other_buffer.data());
+
+			for (size_t j = 0; j < i; j++) {
+				auto cell = discrepancy{i, j, self_row[j], other_row[j]};
+				if (heap.size() < k) {
+					heap.push_back(cell);
+					std::push_heap(heap.begin(), heap.end(), ranks_before);
+				} else if (ranks_before(cell, heap.front())) {
+					std::pop_heap(heap.begin(), heap.end(), ranks_before);
+					heap.back() = cell;
+					std::push_heap(heap.begin(), heap.end(), ranks_before);
+				}
+			}
+		}
 
-double difference_squared(double Dij, double dij)
-{
-	return (Dij - dij) * (Dij - dij);
-}
+#pragma omp critical
+		ret.insert(ret.end(), heap.begin(), heap.end());
+	}
 
-double average_squared(double Dij, double dij)
-{
-	auto temp = (Dij + dij) / 2.0;
-	return temp * temp;
-}
+	std::sort(ret.begin(), ret.end(), ranks_before);
+	ret.resize(std::min(ret.size(), k));
 
-double just_average(double Dij, double dij)
-{
-	auto temp = (Dij + dij) / 2.0;
-	return temp;
+	return ret;
 }
 
-double just_one(double, double)
+/**
+ * @brief Print a list of discrepancies as a table.
+ *
+ * @param self - The matrix providing the names.
+ * @param list - The discrepancies.
+ * @returns the table with a header line.
+ */
+std::string format_discrepancies(const matrix_view &self,
+								 const std::vector<discrepancy> &list)
 {
-	return 1.0;
-}
+	auto ret = std::string("name1\tname2\tfirst\tsecond\tdifference\n");
+	char buf[100];
+
+	for (const auto &cell : list) {
+		ret += self.name(cell.i);
+		ret += '\t';
+		ret += self.name(cell.j);
+		snprintf(buf, sizeof(buf), "\t%9.3e\t%9.3e\t%9.3e\n",
+				 cell.self_value, cell.other_value, cell.difference());
+		ret += buf;
+	}
 
-double difference_abs(double Dij, double dij)
-{
-	return std::fabs(Dij - dij);
+	return ret;
 }
 
-double hausdorff(const matrix &self, const matrix &other)
+/** @brief Look up a comma-separated list of metrics.
+ *
+ * @param list - The names of the metrics.
+ * @returns the metrics.
+ */
+static std::vector<const metric *> parse_metrics(const std::string &list)
 {
-	auto self_names = self.get_names();
-	auto other_names = other.get_names();
-	std::sort(self_names.begin(), self_names.end());
-	std::sort(other_names.begin(), other_names.end());
-
-	if (!std::equal(self_names.begin(), self_names.end(), other_names.begin(),
-					other_names.end())) {
-		warnx("The matrices have different sets of names.");
+	auto ret = std::vector<const metric *>();
+	size_t start = 0;
+
+	while (start <= list.size()) {
+		auto stop = std::min(list.find(',', start), list.size());
+		auto name = list.substr(start, stop - start);
+		start = stop + 1;
+
+		auto it = std::find_if(std::begin(metrics), std::end(metrics),
+							   [&](const metric &m) { return name == m.name; });
+		if (it == std::end(metrics)) {
+			errx(1, "unknown metric '%s'.", name.c_str());
+		}
+		ret.push_back(it);
 	}
 
-	auto new_names = common_names(self_names, other_names);
-
-	auto new_self = sample2(self, new_names.begin(), new_names.end());
-	auto new_other = sample2(other, new_names.begin(), new_names.end());
-
-	auto my_max = [](double a, double b) { return std::max(a, b); };
-	auto other_it = begin_lower_triangle(new_other);
-
-	double dist = std::inner_product(begin_lower_triangle(new_self),
-									 end_lower_triangle(new_self), other_it,
-									 0.0, my_max, difference_abs);
-
-	return dist;
+	return ret;
 }
 
-const auto delta1 = delta<difference_squared, just_Dij_squared>;
-const auto delta2 = delta<difference_squared, average_squared>;
-const auto delta3 = delta<difference_squared, just_Dij>;
-const auto delta4 = delta<difference_squared, just_average>;
-const auto delta5 = delta<difference_abs, just_average>;
-const auto delta6 = delta<difference_squared, just_one>;
-
 static void mat_compare_usage(int status);
 
 /**
@@ -275,10 +545,14 @@ static void mat_compare_usage(int status);
 int mat_compare(int argc, char **argv)
 {
 	int fn_index = 7;
-	auto functions = make_array( //
-		delta1, delta2, delta3, delta4, delta5, rel, delta6, hausdorff);
+	auto selected = std::vector<const metric *>();
+	auto all_pairs = false;
+	auto stream = false;
+	size_t top = 0;
 
 	static struct option long_options[] = {
+		{"all", no_argument, 0, 0},
+		{"all-pairs", no_argument, 0, 0},
 		{"delta1", no_argument, &fn_index, 0},
 		{"delta2", no_argument, &fn_index, 1},
 		{"delta3", no_argument, &fn_index, 2},
@@ -287,7 +561,10 @@ int mat_compare(int argc, char **argv)
 		{"delta6", no_argument, &fn_index, 6},
 		{"hausdorff", no_argument, &fn_index, 7},
 		{"help", no_argument, 0, 0},
+		{"metrics", required_argument, 0, 0},
 		{"rel", no_argument, &fn_index, 5},
+		{"stream", no_argument, 0, 0},
+		{"top", required_argument, 0, 0},
 		{0, 0, 0, 0} //
 	};
 
@@ -304,6 +581,27 @@ int mat_compare(int argc, char **argv)
 			if (option_string == "help") {
 				mat_compare_usage(EXIT_SUCCESS);
 			}
+			if (option_string == "all") {
+				selected.clear();
+				for (const auto &m : metrics) {
+					selected.push_back(&m);
+				}
+			}
+			if (option_string == "metrics") {
+				selected = parse_metrics(optarg);
+			}
+			if (option_string == "all-pairs") {
+				all_pairs = true;
+			}
+			if (option_string == "stream") {
+				stream = true;
+			}
+			if (option_string == "top") {
+				top = parse_count(optarg, "top");
+				if (top == 0) {
+					errx(1, "invalid argument to --top: %s", optarg);
+				}
+			}
 			// fn_index is set by getopt_long
 		} else {
 			mat_compare_usage(EXIT_FAILURE);
@@ -312,20 +610,90 @@ int mat_compare(int argc, char **argv)
 
 	argc -= optind, argv += optind; // hack
 
+	if (int(all_pairs) + int(stream) + int(top > 0) > 1) {
+		errx(1, "The options --all-pairs, --stream and --top exclude each "
+				"other.");
+	}
+
+	if (selected.empty()) {
+		selected.push_back(&metrics[fn_index]);
+	}
+
+	if (all_pairs) {
+		auto matrices = parse_all(argv);
+		if (matrices.size() < 2) {
+			errx(1, "At least two matrices must be provided.");
+		}
+
+		// print one matrix per metric
+		for (const auto &result : compare_all_pairs(matrices, selected)) {
+			std::cout << result.to_string();
+		}
+		return 0;
+	}
+
 	if (argc < 2) mat_compare_usage(EXIT_FAILURE);
 
 	auto first_file_name = std::string(argv[0]);
 	auto second_file_name = std::string(argv[1]);
 
+	if (top > 0) {
+		auto first_matrices = parse(first_file_name);
+		auto second_matrices = parse(second_file_name);
+
+		auto count = std::min(first_matrices.size(), second_matrices.size());
+		for (size_t i = 0; i < count; i++) {
+			const auto &self = first_matrices[i];
+			const auto &other = second_matrices[i];
+			auto names = common_names(self.get_names(), other.get_names());
+			if (names.empty()) {
+				errx(1, "The matrices have no names in common.");
+			}
+			auto new_self = sample_view(self, names.begin(), names.end());
+			auto new_other = sample_view(other, names.begin(), names.end());
+
+			auto list = top_discrepancies(new_self, new_other, top);
+			std::cout << format_discrepancies(new_self, list);
+		}
+		return 0;
+	}
+
+	// with multiple metrics, print a table
+	if (selected.size() > 1) {
+		for (size_t k = 0; k < selected.size(); k++) {
+			std::cout << (k ? "\t" : "") << selected[k]->name;
+		}
+		std::cout << std::endl;
+	}
+
+	auto print = [](const std::vector<double> &dists) {
+		for (size_t k = 0; k < dists.size(); k++) {
+			std::cout << (k ? "\t" : "") << dists[k];
+		}
+		std::cout << std::endl;
+	};
+
+	size_t done = 0;
+	if (stream) {
+		if (compare_streaming(first_file_name, second_file_name, selected,
+							  done, print)) {
+			return 0;
+		}
+
+		if (first_file_name == "-" || second_file_name == "-") {
+			errx(1, "The names are ordered differently; cannot reread stdin.");
+		}
+		warnx("The names are ordered differently; reading the full "
+			  "matrices.");
+	}
+
 	auto first_matrices = parse(first_file_name);
 	auto second_matrices = parse(second_file_name);
 
 	// check first and second matrices
 	auto count = std::min(first_matrices.size(), second_matrices.size());
-	for (size_t i = 0; i < count; i++) {
-		auto fn = functions[fn_index];
-		double dist = fn(first_matrices[i], second_matrices[i]);
-		std::cout << dist << std::endl;
+	for (size_t i = done; i < count; i++) {
+		print(compare(first_matrices[i], second_matrices[i], selected));
 	}
 
 	return 0;
@@ -335,6 +703,7 @@ static void mat_compare_usage(int status)
 {
 	static const char str[] = {
 		"usage: mat compare [OPTIONS] FILE1 FILE2\n" // this comment is a hack
+		"       mat compare --all-pairs [OPTIONS] [FILE...]\n"
 		"Measure the distance of distances matrices from two files.\n\n"
 		"Available options:\n"
 		"  --delta1        Compute directed Fitch-Margoliash distance\n"
@@ -342,9 +711,19 @@ static void mat_compare_usage(int status)
 		"  --delta3        \n"
 		"  --delta4        \n"
 		"  --delta5        \n"
+		"  --delta6        \n"
 		"  --hausdorff     Find the biggest absolute difference\n"
 		"  --help          Print this help\n"
-		"  --rel           Compute the average relative dissimilarity\n"};
+		"  --rel           Compute the average relative dissimilarity\n"
+		"  --all           Compute all of the above metrics at once\n"
+		"  --metrics LIST  Compute a comma-separated list of metrics, i.e.\n"
+		"                  --metrics=delta1,rel,hausdorff\n"
+		"  --all-pairs     Compare all matrices from all FILEs with each\n"
+		"                  other and print a distance matrix per metric\n"
+		"  --stream        Read both files row by row; needs the same order\n"
+		"                  of names, otherwise falls back to reading it all\n"
+		"  --top K         Print the K cells with the largest absolute\n"
+		"                  difference instead\n"};
 
 	fprintf(status == EXIT_SUCCESS ? stdout : stderr, str);
 	exit(status);
@@ -15,8 +15,22 @@
  */
 #pragma once
 
+#include <cmath>
 #include "matrix.h"
 
-double p1_norm(const matrix &self, const matrix &other);
-double p2_norm(const matrix &self, const matrix &other);
-double rel(const matrix &self, const matrix &other);
+/** @brief A cell in which two aligned matrices differ. */
+struct discrepancy {
+	matrix::size_type i, j;
+	double self_value, other_value;
+
+	double difference() const noexcept
+	{
+		return std::fabs(self_value - other_value);
+	}
+};
+
+std::vector<discrepancy> top_discrepancies(const matrix_view &self,
+										   const matrix_view &other,
+										   size_t k);
+std::string format_discrepancies(const matrix_view &self,
+								 const std::vector<discrepancy> &list);
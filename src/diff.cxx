@@ -21,25 +21,48 @@
 #include <string>
 #include <unordered_map>
 #include <vector>
+#include "compare.h"
 #include "matrix.h"
 
-matrix diff(const matrix &self, const matrix &other)
+/**
+ * @brief Print the difference of two aligned matrices row by row, without
+ * building the difference matrix. In lower triangle format, only the cells
+ * below the main diagonal are computed.
+ *
+ * @param out - The stream to write to.
+ * @param self - One matrix.
+ * @param other - The other matrix with the same names in the same order.
+ * @param lower_triangle - Iff true, print only the lower triangle.
+ */
+void diff(std::ostream &out, const matrix_view &self, const matrix_view &other,
+		  bool lower_triangle)
 {
-	auto new_names = common_names(self.get_names(), other.get_names());
-	auto new_self = sample2(self, new_names.begin(), new_names.end());
-	auto new_other = sample2(other, new_names.begin(), new_names.end());
-
-	auto size = new_names.size();
-	auto ret = matrix(new_names, std::vector<double>(size * size));
-
-	auto self_it = begin_square(new_self);
-	auto other_it = begin_square(new_other);
+	auto size = self.get_size();
+	auto self_buffer = std::vector<double>(size);
+	auto other_buffer = std::vector<double>(size);
+	auto difference = std::vector<double>(size);
+	auto line = std::string();
+
+	out << size << "\n";
+
+	for (size_t i = 0; i < size; i++) {
+		auto length = lower_triangle ? i : size;
+		if (lower_triangle) {
+			auto self_row = self.lower_row(i, self_buffer.data());
+			auto other_row = other.lower_row(i, other_buffer.data());
+			for (size_t j = 0; j < i; j++) {
+				difference[j] = self_row[j] - other_row[j];
+			}
+		} else {
+			for (size_t j = 0; j < size; j++) {
+				difference[j] = self.entry(i, j) - other.entry(i, j);
+			}
+		}
 
-	for (auto it = begin_square(ret); it != end_square(ret); it++) {
-		*it = *self_it++ - *other_it++;
+		line.clear();
+		format_row(line, self.name(i), difference.data(), length);
+		out << line;
 	}
-
-	return ret;
 }
 
 static void mat_diff_usage(int status);
@@ -55,14 +78,17 @@ int mat_diff(int argc, char **argv)
 {
 	static struct option long_options[] = {
 		{"help", no_argument, 0, 0}, // print help
-		{0, 0, 0, 0}				 //
+		{"lower-triangle", no_argument, 0, 'l'},
+		{"top", required_argument, 0, 0},
+		{0, 0, 0, 0} //
 	};
 
-	bool full_matrix = false;
+	size_t top = 0;
+	auto lower_triangle = false;
 
 	while (true) {
 		int long_index;
-		int c = getopt_long(argc, argv, "", long_options, &long_index);
+		int c = getopt_long(argc, argv, "l", long_options, &long_index);
 
 		if (c == -1) {
 			break;
@@ -75,8 +101,15 @@ int mat_diff(int argc, char **argv)
 				if (option_string == "help") {
 					mat_diff_usage(EXIT_SUCCESS);
 				}
+				if (option_string == "top") {
+					top = parse_count(optarg, "top");
+					if (top == 0) {
+						errx(1, "invalid argument to --top: %s", optarg);
+					}
+				}
 				break;
 			}
+			case 'l': lower_triangle = true; break;
 			default: /* intentional fall-through */
 			case '?': mat_diff_usage(EXIT_FAILURE);
 		}
@@ -84,13 +117,29 @@ int mat_diff(int argc, char **argv)
 
 	argc -= optind, argv += optind; // hack
 
+	if (top > 0 && lower_triangle) {
+		errx(1, "The options --lower-triangle and --top exclude each other.");
+	}
+
 	auto matrices = parse_all(argv);
 
 	if (matrices.size() < 2) {
 		errx(1, "At least two matrices must be provided.");
 	}
 
-	std::cout << diff(matrices[0], matrices[1]).to_string();
+	const auto &self = matrices[0];
+	const auto &other = matrices[1];
+	auto names = common_names(self.get_names(), other.get_names());
+	auto new_self = sample_view(self, names.begin(), names.end());
+	auto new_other = sample_view(other, names.begin(), names.end());
+
+	if (top > 0) {
+		auto list = top_discrepancies(new_self, new_other, top);
+		std::cout << format_discrepancies(new_self, list);
+		return 0;
+	}
+
+	diff(std::cout, new_self, new_other, lower_triangle);
 
 	return 0;
 }
@@ -101,7 +150,9 @@ static void mat_diff_usage(int status)
 		"usage: mat diff [OPTIONS] [FILE...]\n" // this comment is a hack
 		"Compute euclidean distance of two distances matrices.\n\n"
 		"Available options:\n"
-		"     --help          print this help\n"};
+		" -l, --lower-triangle  print only the lower triangle\n"
+		"     --top K           only print the K largest absolute differences\n"
+		"     --help            print this help\n"};
 
 	fprintf(status == EXIT_SUCCESS ? stdout : stderr, str);
 	exit(status);
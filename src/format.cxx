@@ -13,15 +13,22 @@
  * You should have received a copy of the GNU General Public License
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
+#include <algorithm>
 #include <cassert>
 #include <cmath>
+#include <cstdlib>
+#include <cstring>
 #include <err.h>
 #include <errno.h>
+#include <functional>
 #include <getopt.h>
 #include <iostream>
 #include <numeric>
+#include <random>
 #include <regex>
 #include <string>
+#include <string_view>
+#include <unordered_set>
 #include <vector>
 #include "matrix.h"
 
@@ -34,17 +41,21 @@ static const /*expr*/ auto close_enough = [](double a, double b) {
 };
 
 /**
- * @brief Rearrange matrix by sorted names
+ * @brief Rearrange matrix by sorted names. Only the row indices are sorted,
+ * so neither names nor values are copied or looked up.
  *
  * @param self - the matrix to rearrange
- * @returns sorted matrix
+ * @returns a sorted view of the matrix
  */
-static matrix sort(const matrix &self)
+static matrix_view sort(const matrix &self)
 {
-	auto names = self.get_names();
-	std::sort(begin(names), end(names));
+	const auto &names = self.get_names();
+	auto order = std::vector<matrix::size_type>(self.get_size());
+	std::iota(begin(order), end(order), 0);
+	std::sort(begin(order), end(order),
+			  [&](auto a, auto b) { return names[a] < names[b]; });
 
-	return sample2(self, begin(names), end(names));
+	return matrix_view(self, std::move(order));
 }
 
 /**
@@ -77,9 +88,75 @@ static char unescape(const char *str)
 	return ret;
 }
 
+/// Number of example positions reported per kind of fixed cell.
+static const size_t FIX_EXAMPLES = 3;
+
+/// What fix() changed, aggregated over all cells.
+struct fix_stats {
+	size_t negative = 0, diagonal = 0, asymmetric = 0;
+	/// The smallest positions of each kind, in row-major order.
+	std::vector<std::pair<size_t, size_t>> negative_examples = {},
+										   diagonal_examples = {},
+										   asymmetric_examples = {};
+	/// The largest difference of an averaged pair, and its position.
+	double max_asymmetry = 0.0;
+	size_t max_i = 0, max_j = 0;
+
+	/** @brief Add the statistics of another part of the matrix.
+	 *
+	 * @param other - The statistics of other rows.
+	 */
+	void merge(const fix_stats &other)
+	{
+		auto append = [](std::vector<std::pair<size_t, size_t>> &self,
+						 const std::vector<std::pair<size_t, size_t>> &more) {
+			self.insert(self.end(), more.begin(), more.end());
+			std::sort(self.begin(), self.end());
+			self.resize(std::min(self.size(), FIX_EXAMPLES));
+		};
+
+		negative += other.negative;
+		diagonal += other.diagonal;
+		asymmetric += other.asymmetric;
+		append(negative_examples, other.negative_examples);
+		append(diagonal_examples, other.diagonal_examples);
+		append(asymmetric_examples, other.asymmetric_examples);
+
+		auto other_first = std::make_pair(other.max_i, other.max_j) <
+						   std::make_pair(max_i, max_j);
+		if (other.max_asymmetry > max_asymmetry ||
+			(other.max_asymmetry == max_asymmetry && other_first)) {
+			max_asymmetry = other.max_asymmetry;
+			max_i = other.max_i;
+			max_j = other.max_j;
+		}
+	}
+};
+
+/**
+ * @brief Format a list of positions for a warning.
+ *
+ * @param examples - The positions.
+ * @returns the positions as "(i,j), (k,l)".
+ */
+static std::string format_examples(
+	const std::vector<std::pair<size_t, size_t>> &examples)
+{
+	auto ret = std::string{};
+	for (const auto &pos : examples) {
+		if (!ret.empty()) ret += ", ";
+		ret += "(" + std::to_string(pos.first) + "," +
+			   std::to_string(pos.second) + ")";
+	}
+	return ret;
+}
+
 /**
  * @brief Validate that the matrix is a proper distance matrix, and fix issues
- * where possible.
+ * where possible. Negative entries become 0, as does the main diagonal, and
+ * asymmetric pairs are averaged. All checks happen in a single parallel pass
+ * over the lower triangle; instead of a warning per cell, a summary is
+ * printed.
  *
  * @param self - The matrix to validate.
  * @returns the fixed matrix.
@@ -88,42 +165,350 @@ static matrix fix(const matrix &original)
 {
 	auto self = matrix(original);
 	auto size = self.get_size();
+	auto stats = fix_stats{};
+
+#pragma omp parallel
+	{
+		auto local = fix_stats{};
+		// Keep the smallest positions in row-major order. Cells (j,i) of the
+		// upper triangle are found while scanning row i, so this is not
+		// simply the order in which they are found.
+		auto note = [](std::vector<std::pair<size_t, size_t>> &examples,
+					   size_t i, size_t j) {
+			auto position = std::make_pair(i, j);
+			if (examples.size() == FIX_EXAMPLES) {
+				if (!(position < examples.back())) return;
+				examples.pop_back();
+			}
+			examples.insert(std::upper_bound(examples.begin(), examples.end(),
+											 position),
+							position);
+		};
+
+#pragma omp for schedule(dynamic, 16) nowait
+		for (size_t i = 0; i < size; i++) {
+			for (size_t j = 0; j < i; j++) {
+				auto lower = self.entry(i, j), upper = self.entry(j, i);
+
+				// check positivity
+				if (lower < 0) {
+					local.negative++;
+					note(local.negative_examples, i, j);
+					lower = 0.0;
+				}
+				if (upper < 0) {
+					local.negative++;
+					note(local.negative_examples, j, i);
+					upper = 0.0;
+				}
 
-	// check positivity
-	for (size_t i = 0; i < size; i++) {
-		for (size_t j = 0; j < size; j++) {
-			if (self.entry(i, j) < 0) {
-				warnx("Fixed entry (%zu,%zu); was negative: %lf, now 0.", i, j,
-					  self.entry(i, j));
-				self.entry(i, j) = 0.0;
+				// check symmetry
+				if (!close_enough(lower, upper)) {
+					local.asymmetric++;
+					note(local.asymmetric_examples, i, j);
+
+					auto difference = std::fabs(lower - upper);
+					if (difference > local.max_asymmetry) {
+						local.max_asymmetry = difference;
+						local.max_i = i;
+						local.max_j = j;
+					}
+
+					lower = upper = (lower + upper) / 2.0;
+				}
+
+				self.entry(i, j) = lower;
+				self.entry(j, i) = upper;
+			}
+
+			// check main diagonal
+			if (self.entry(i, i) != 0) {
+				local.diagonal++;
+				note(local.diagonal_examples, i, i);
+				self.entry(i, i) = 0.0;
 			}
 		}
+
+#pragma omp critical
+		stats.merge(local);
 	}
 
-	// check main diagonal
-	for (size_t i = 0; i < size; i++) {
-		if (self.entry(i, i) != 0) {
-			warnx("Fixed entry (%zu,%zu); was %lf, now is 0.", i, i,
-				  self.entry(i, i));
-			self.entry(i, i) = 0.0;
+	if (stats.negative) {
+		warnx("Fixed %zu negative entries, now 0; e.g. %s.", stats.negative,
+			  format_examples(stats.negative_examples).c_str());
+	}
+	if (stats.diagonal) {
+		warnx("Fixed %zu entries on the main diagonal, now 0; e.g. %s.",
+			  stats.diagonal, format_examples(stats.diagonal_examples).c_str());
+	}
+	if (stats.asymmetric) {
+		warnx("Averaged %zu asymmetric pairs of cells; e.g. %s. The largest "
+			  "difference was %lf at (%zu,%zu).",
+			  stats.asymmetric,
+			  format_examples(stats.asymmetric_examples).c_str(),
+			  stats.max_asymmetry, stats.max_i, stats.max_j);
+	}
+
+	return self;
+}
+
+/// A triple with d(i,j) > d(i,k) + d(k,j), where i > j and k is any other row.
+struct violation {
+	size_t i, j, k;
+
+	bool operator<(const violation &other) const noexcept
+	{
+		if (i != other.i) return i < other.i;
+		if (j != other.j) return j < other.j;
+		return k < other.k;
+	}
+};
+
+/// Rows per tile of the triangle check.
+static const size_t TILE_ROWS = 64;
+/// Columns per tile; two tiles of doubles should fit into the L2 cache.
+static const size_t TILE_COLUMNS = 512;
+
+/**
+ * @brief The triangle inequality d(i,j) ≤ d(i,k) + d(k,j) is violated iff the
+ * detour d(i,k) + d(k,j) is shorter than this bound, i.e. it is shorter than
+ * d(i,j) and not close_enough().
+ *
+ * @param dij - A nonnegative distance.
+ * @returns the bound.
+ */
+static double triangle_bound(double dij)
+{
+	return std::min(dij, dij * (1.0 - PRECISION));
+}
+
+/**
+ * @brief Check one side of a triangle.
+ *
+ * @param side - The direct distance, nonnegative.
+ * @param detour - The distance via the third point.
+ * @returns true iff the side violates the triangle inequality.
+ */
+static bool longer_than_detour(double side, double detour)
+{
+	return detour < triangle_bound(side);
+}
+
+/**
+ * @brief Compute min_k a[k] + b[k] over a range, starting from init. Four
+ * independent minima hide the latency of the comparisons, which a single
+ * vectorized reduction does not.
+ *
+ * @param a - One row.
+ * @param b - The other row.
+ * @param first - The first column.
+ * @param last - One past the last column.
+ * @param init - The initial minimum.
+ * @returns the minimum.
+ */
+static double shortest_path(const double *a, const double *b, size_t first,
+							size_t last, double init)
+{
+	double m0 = init, m1 = init, m2 = init, m3 = init;
+	auto k = first;
+	for (; k + 4 <= last; k += 4) {
+		m0 = std::min(m0, a[k] + b[k]);
+		m1 = std::min(m1, a[k + 1] + b[k + 1]);
+		m2 = std::min(m2, a[k + 2] + b[k + 2]);
+		m3 = std::min(m3, a[k + 3] + b[k + 3]);
+	}
+	for (; k < last; k++) {
+		m0 = std::min(m0, a[k] + b[k]);
+	}
+	return std::min(std::min(m0, m1), std::min(m2, m3));
+}
+
+/**
+ * @brief Check the triangle inequality for all triples. Every pair (i,j) is
+ * checked against the detours via all other rows k, so each side of each
+ * triangle is covered. The loops over i, j, and k are tiled, so that the parts
+ * of rows i and j in use stay in cache, and the i-tiles are distributed among
+ * threads. For each pair (i,j) the innermost loop is a min-plus sweep,
+ * min_k d(i,k) + d(k,j); only if that minimum violates the inequality are the
+ * positions collected.
+ *
+ * @param self - The matrix to check, assumed to be symmetric and nonnegative.
+ * @param max_reported - The number of violations to return; 0 for all.
+ * @param count - Set to the total number of violations.
+ * @returns the first violations, ordered by (i, j, k).
+ */
+static std::vector<violation>
+triangle_violations(const matrix &self, size_t max_reported, size_t &count)
+{
+	auto size = self.get_size();
+	const auto *data = self.get_values().data();
+
+	auto ret = std::vector<violation>{};
+	count = 0;
+
+#pragma omp parallel
+	{
+		// the last violation in order is at the front
+		auto heap = std::vector<violation>{};
+		size_t local_count = 0;
+
+		auto record = [&](const violation &v) {
+			if (max_reported == 0 || heap.size() < max_reported) {
+				heap.push_back(v);
+				std::push_heap(heap.begin(), heap.end());
+			} else if (v < heap.front()) {
+				std::pop_heap(heap.begin(), heap.end());
+				heap.back() = v;
+				std::push_heap(heap.begin(), heap.end());
+			}
+		};
+
+#pragma omp for schedule(dynamic, 1) nowait
+		for (size_t i0 = 0; i0 < size; i0 += TILE_ROWS) {
+			auto i1 = std::min(i0 + TILE_ROWS, size);
+
+			for (size_t j0 = 0; j0 < i1; j0 += TILE_ROWS) {
+				auto j1 = std::min(j0 + TILE_ROWS, i1);
+
+				for (size_t k0 = 0; k0 < size; k0 += TILE_COLUMNS) {
+					auto k1 = std::min(k0 + TILE_COLUMNS, size);
+
+					for (size_t i = i0; i < i1; i++) {
+						const auto *row_i = data + i * size;
+						auto j_end = std::min(j1, i);
+
+						for (size_t j = j0; j < j_end; j++) {
+							const auto *row_j = data + j * size;
+							auto dij = row_i[j];
+
+							// k = i and k = j give d(i,j) itself, as the
+							// main diagonal is zero
+							auto shortest =
+								shortest_path(row_i, row_j, k0, k1, dij);
+							if (!longer_than_detour(dij, shortest)) continue;
+
+							for (size_t k = k0; k < k1; k++) {
+								if (k == i || k == j) continue;
+								auto detour = row_i[k] + row_j[k];
+								if (longer_than_detour(dij, detour)) {
+									local_count++;
+									record(violation{i, j, k});
+								}
+							}
+						}
+					}
+				}
+			}
 		}
+
+#pragma omp critical
+		{
+			count += local_count;
+			ret.insert(ret.end(), heap.begin(), heap.end());
+		}
+	}
+
+	std::sort(ret.begin(), ret.end());
+	if (max_reported != 0) {
+		ret.resize(std::min(ret.size(), max_reported));
+	}
+
+	return ret;
+}
+
+/// Number of largest entries whose triples are all checked when sampling.
+static const size_t SAMPLE_TOP_ENTRIES = 10;
+
+/**
+ * @brief Check whether any side of a triangle is longer than the detour via
+ * the third point.
+ *
+ * @param self - The matrix, assumed to be symmetric and nonnegative.
+ * @param a - The first point.
+ * @param b - The second point.
+ * @param c - The third point.
+ * @returns true iff the triple violates the triangle inequality.
+ */
+static bool violates_triangle(const matrix &self, size_t a, size_t b, size_t c)
+{
+	auto ab = self.entry(a, b), ac = self.entry(a, c), bc = self.entry(b, c);
+	return longer_than_detour(ab, ac + bc) || longer_than_detour(ac, ab + bc) ||
+		   longer_than_detour(bc, ab + ac);
+}
+
+/**
+ * @brief Estimate how many triples violate the triangle inequality from a
+ * random sample, instead of checking all of them. Large entries are the most
+ * likely to be too large, so in addition every triple touching one of the
+ * largest entries is checked exhaustively. A summary is printed to stderr.
+ *
+ * @param self - The matrix to check, assumed to be symmetric and nonnegative.
+ * @param samples - The number of random triples; at least one.
+ * @param seed - The seed of the random number generator.
+ * @returns the number of violations found.
+ */
+static size_t sample_triangle_violations(const matrix &self, size_t samples,
+										 unsigned long seed)
+{
+	auto size = self.get_size();
+	if (size < 3) return 0;
+
+	auto rng = std::mt19937_64{seed};
+	auto pick = std::uniform_int_distribution<size_t>{0, size - 1};
+
+	size_t sampled_violations = 0;
+	for (size_t s = 0; s < samples; s++) {
+		auto a = pick(rng), b = pick(rng), c = pick(rng);
+		while (b == a) b = pick(rng);
+		while (c == a || c == b) c = pick(rng);
+
+		sampled_violations += violates_triangle(self, a, b, c);
 	}
 
-	// check symmetry
+	// Wilson score interval at 95% confidence
+	const auto z = 1.96;
+	auto n = double(samples);
+	auto rate = sampled_violations / n;
+	auto center = (rate + z * z / (2 * n)) / (1 + z * z / n);
+	auto spread = z / (1 + z * z / n) *
+				  std::sqrt(rate * (1 - rate) / n + z * z / (4 * n * n));
+
+	warnx("%zu of %zu sampled triples violate the triangle inequality; "
+		  "estimated rate %.3e (95%% CI %.3e to %.3e).",
+		  sampled_violations, samples, rate, std::max(0.0, center - spread),
+		  std::min(1.0, center + spread));
+
+	// the largest entries of the lower triangle, by position
+	using cell = std::pair<double, std::pair<size_t, size_t>>;
+	auto top = std::vector<cell>{};
 	for (size_t i = 0; i < size; i++) {
 		for (size_t j = 0; j < i; j++) {
-			if (!close_enough(self.entry(i, j), self.entry(j, i))) {
-				warnx("Fixed asymmetric cells (%zu,%zu) and (%zu,%zu); entries "
-					  "are now averaged.",
-					  i, j, j, i);
-
-				auto avg = (self.entry(i, j) + self.entry(j, i)) / 2.0;
-				self.entry(i, j) = self.entry(j, i) = avg;
+			auto entry = cell{self.entry(i, j), {i, j}};
+			if (top.size() < SAMPLE_TOP_ENTRIES) {
+				top.push_back(entry);
+				std::push_heap(top.begin(), top.end(), std::greater<cell>{});
+			} else if (entry > top.front()) {
+				std::pop_heap(top.begin(), top.end(), std::greater<cell>{});
+				top.back() = entry;
+				std::push_heap(top.begin(), top.end(), std::greater<cell>{});
 			}
 		}
 	}
 
-	return self;
+	size_t top_violations = 0;
+	for (const auto &entry : top) {
+		auto i = entry.second.first, j = entry.second.second;
+		for (size_t k = 0; k < size; k++) {
+			if (k == i || k == j) continue;
+			top_violations += violates_triangle(self, i, j, k);
+		}
+	}
+
+	warnx("%zu triples touching the %zu largest entries violate the "
+		  "triangle inequality.",
+		  top_violations, top.size());
+
+	return sampled_violations + top_violations;
 }
 
 /**
@@ -132,29 +517,35 @@ static matrix fix(const matrix &original)
  *
  * @param self - The matrix to validate.
  * @param truncate_names - True iff names are truncated.
+ * @param max_violations - The number of triangle inequality violations to
+ * report; 0 for all.
+ * @param samples - The number of triples to sample; 0 checks all triples.
+ * @param seed - The seed for sampling.
  * @returns the fixed matrix.
  */
-static matrix validate(const matrix &original, bool truncate_names)
+static matrix validate(const matrix &original, bool truncate_names,
+					   size_t max_violations, size_t samples,
+					   unsigned long seed)
 {
 	auto self = matrix{original};
 	auto size = self.get_size();
 
-	// maybe only check first ten chars?
-	auto equal = [=](const std::string &a, const std::string &b) {
-		return truncate_names ? a.compare(0, 10, b, 0, 10) == 0 : a == b;
-	};
-
-	// check name uniqueness
-	auto names_copy = self.get_names();
-	std::sort(names_copy.begin(), names_copy.end());
-	for (size_t i = 0; i < size - 1; i++) {
-		if (equal(names_copy[i], names_copy[i + 1])) {
-			// I don't know what to do — panic!
-			auto str = truncate_names
-						   ? "The truncated name %.10s appears twice."
-						   : "The name %s appears twice.";
-			errx(1, str, names_copy[i].c_str());
+	// check name uniqueness; full names were already checked while parsing
+	if (truncate_names) {
+		auto prefixes = std::unordered_set<std::string_view>{};
+		prefixes.reserve(size);
+		for (auto name : self.get_names()) {
+			auto prefix = name.substr(0, 10);
+			if (!prefixes.insert(prefix).second) {
+				// I don't know what to do — panic!
+				errx(1, "The truncated name %.*s appears twice.",
+					 int(prefix.size()), prefix.data());
+			}
 		}
+	} else if (self.has_duplicate_names()) {
+		auto duplicate = self.duplicate_name();
+		errx(1, "The name %.*s appears twice.", int(duplicate.size()),
+			 duplicate.data());
 	}
 
 	// check nan and zero beyond main diagonal
@@ -170,21 +561,23 @@ static matrix validate(const matrix &original, bool truncate_names)
 	}
 
 	// check triangle inequality
-	for (size_t i = 0; i < size; i++) {
-		for (size_t j = 0; j < i; j++) {
-			for (size_t k = 0; k < j; k++) {
-				// ensure d(i,j) ≤ d(i,k) + d(k,j)
-				if (self.entry(i, j) > self.entry(i, k) + self.entry(j, k) &&
-					!close_enough(self.entry(i, j),
-								  self.entry(i, k) + self.entry(j, k))) {
-					// panic
-					errx(1,
-						 "Violation of triangle inequality for (%zu,%zu) "
-						 "and (%zu,%zu)+(%zu,%zu)",
-						 i, j, i, k, k, j);
-				}
-			}
+	if (samples > 0) {
+		if (sample_triangle_violations(self, samples, seed) > 0) {
+			errx(1, "The sample violates the triangle inequality.");
 		}
+		return self;
+	}
+
+	size_t count = 0;
+	auto violations = triangle_violations(self, max_violations, count);
+	for (const auto &v : violations) {
+		warnx("Violation of triangle inequality for (%zu,%zu) "
+			  "and (%zu,%zu)+(%zu,%zu)",
+			  v.i, v.j, v.i, v.k, v.k, v.j);
+	}
+	if (count > 0) {
+		// panic
+		errx(1, "%zu violations of the triangle inequality.", count);
 	}
 
 	return self;
@@ -203,19 +596,23 @@ int mat_format(int argc, char **argv)
 		{"help", no_argument, 0, 'h'}, // print help
 		{"truncate-names", no_argument, 0, 0},
 		{"sort", no_argument, 0, 's'}, // sort by name
-		{"validate", no_argument, 0, 'v'},
+		{"validate", optional_argument, 0, 'v'},
 		{"fix", no_argument, 0, 'f'},
 		{"precision", required_argument, 0, 0},
 		{"separator", required_argument, 0, 0},
 		{"format", required_argument, 0, 0},
+		{"max-violations", required_argument, 0, 0},
+		{"seed", required_argument, 0, 0},
 		// {"apply-jc", no_argument, 0, 0},
 		// {"unapply-jc", no_argument, 0, 0},
 		{0, 0, 0, 0} //
 	};
 
 	auto fix_flag = false;
-	auto format_flag = false;
 	auto format_specifier = "%9.3e";
+	auto max_violations = size_t{10};
+	auto samples = size_t{0};
+	auto seed = 0UL;
 	auto separator = ' ';
 	auto sort_flag = false;
 	auto truncate_names = false;
@@ -235,7 +632,6 @@ int mat_format(int argc, char **argv)
 				auto option_str = std::string{long_options[long_index].name};
 				if (option_str == "separator") {
 					separator = unescape(optarg);
-					format_flag = true;
 					break;
 				}
 
@@ -253,7 +649,6 @@ int mat_format(int argc, char **argv)
 						err(errno, "invalid format specifier: %s", optarg);
 					}
 
-					format_flag = true;
 					break;
 				}
 
@@ -263,9 +658,18 @@ int mat_format(int argc, char **argv)
 					break;
 				}
 
+				if (option_str == "max-violations") {
+					max_violations = parse_count(optarg, "max-violations");
+					break;
+				}
+
+				if (option_str == "seed") {
+					seed = parse_count(optarg, "seed");
+					break;
+				}
+
 				if (option_str == "truncate-names") {
 					truncate_names = true;
-					format_flag = true;
 					break;
 				}
 				break;
@@ -273,6 +677,15 @@ int mat_format(int argc, char **argv)
 			case 'f': fix_flag = true; break;
 			case 'h': mat_format_usage(EXIT_SUCCESS);
 			case 'v':
+				if (optarg) {
+					if (strncmp(optarg, "sample:", 7) != 0) {
+						errx(1, "invalid validation mode: %s", optarg);
+					}
+					samples = parse_count(optarg + 7, "validate=sample");
+					if (samples == 0) {
+						errx(1, "invalid validation mode: %s", optarg);
+					}
+				}
 				validate_flag = true;
 				fix_flag = true;
 				break;
@@ -292,17 +705,12 @@ int mat_format(int argc, char **argv)
 		}
 
 		if (validate_flag) {
-			m = validate(m, truncate_names);
-		}
-
-		if (sort_flag) {
-			m = sort(m);
+			m = validate(m, truncate_names, max_violations, samples,
+						 seed);
 		}
 
-		auto str = format_flag
-					   ? format(m, separator, format_specifier, truncate_names)
-					   : m.to_string();
-		std::cout << str;
+		auto view = sort_flag ? sort(m) : matrix_view(m);
+		std::cout << format(view, separator, format_specifier, truncate_names);
 	}
 
 	return 0;
@@ -323,13 +731,23 @@ static void mat_format_usage(int status)
 		"  -f, --fix             fix small errors\n"
 		"      --format <str>    use <str> as the format string; default: "
 		"%%1.4e\n"
+		"      --max-violations <n>\n"
+		"                        report the first <n> violations of the "
+		"triangle\n"
+		"                        inequality; 0 for all; default: 10\n"
 		"      --precision <flt> precision to use in comparisons; default: "
 		"0.05\n"
+		"      --seed <n>        seed for --validate=sample; default: 0\n"
 		"      --separator <c>   set the cell separator to <c>; default: ' ' "
 		"aka. space\n"
 		"  -s, --sort            sort by name\n"
 		"      --truncate-names  truncate names to ten characters\n"
 		"  -v, --validate        validate for correctness (implies -f)\n"
+		"      --validate=sample:<n>\n"
+		"                        only check <n> random triples and those "
+		"touching\n"
+		"                        the largest entries for the triangle "
+		"inequality\n"
 		"  -h, --help            print this help\n"};
 
 	fprintf(status == EXIT_SUCCESS ? stdout : stderr, str);
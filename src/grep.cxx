@@ -17,33 +17,272 @@
 #include <cstdio>
 #include <cstdlib>
 #include <err.h>
+#include <errno.h>
+#include <fstream>
 #include <getopt.h>
 #include <iostream>
 #include <numeric>
 #include <regex>
 #include <string>
+#include <string_view>
+#include <sys/stat.h>
+#include <unordered_set>
 #include <vector>
 #include "matrix.h"
 
-/** @brief Grep names and remove names that don't match the given pattern.
+/** @brief A compiled name pattern. Simple patterns, a literal string that
+ * may be anchored at the start or end, are matched with plain string
+ * operations. Everything else is handed to std::regex, which is slow.
+ */
+class name_matcher
+{
+	enum class kind { regex, substring, prefix, suffix, exact };
+
+	kind m_kind = kind::regex;
+	std::string literal = {};
+	std::regex rpattern = {};
+
+	/** @brief Try to read the pattern as an optionally anchored literal.
+	 *
+	 * @param pattern - An ECMAScript regular expression.
+	 * @returns true iff the pattern is a literal; then kind and literal are
+	 * set.
+	 */
+	bool parse_literal(const std::string &pattern)
+	{
+		static const auto syntax_characters = std::string{"^$\\.*+?()[]{}|/"};
+
+		auto first = pattern.begin(), last = pattern.end();
+		auto anchored_start = first != last && *first == '^';
+		if (anchored_start) first++;
+
+		auto anchored_end = false;
+		for (auto it = first; it != last; it++) {
+			if (*it == '\\') {
+				// only escaped syntax characters stand for themselves
+				if (++it == last ||
+					syntax_characters.find(*it) == std::string::npos) {
+					return false;
+				}
+				literal += *it;
+			} else if (*it == '$' && it + 1 == last) {
+				anchored_end = true;
+			} else if (syntax_characters.find(*it) != std::string::npos) {
+				return false;
+			} else {
+				literal += *it;
+			}
+		}
+
+		m_kind = anchored_start
+					 ? (anchored_end ? kind::exact : kind::prefix)
+					 : (anchored_end ? kind::suffix : kind::substring);
+		return true;
+	}
+
+  public:
+	/** @brief Compile a pattern.
+	 *
+	 * @param pattern - An ECMAScript regular expression.
+	 * @param fast - Iff true, use string operations for simple patterns.
+	 */
+	name_matcher(const std::string &pattern, bool fast)
+	{
+		if (!fast || !parse_literal(pattern)) {
+			m_kind = kind::regex;
+			literal.clear();
+			rpattern = std::regex(pattern);
+		}
+	}
+
+	bool operator()(std::string_view name) const
+	{
+		auto n = name.size(), m = literal.size();
+		switch (m_kind) {
+			case kind::substring:
+				return name.find(literal) != std::string::npos;
+			case kind::prefix: return name.compare(0, m, literal) == 0;
+			case kind::suffix:
+				return n >= m && name.compare(n - m, m, literal) == 0;
+			case kind::exact: return name == literal;
+			case kind::regex: // intentional fall-through
+			default:
+				return std::regex_search(name.begin(), name.end(), rpattern);
+		}
+	}
+};
+
+/** @brief Find the names matching a pattern.
  *
- * @param self - The matrix to subsample.
- * @param rpattern - The regex pattern to search for.
+ * @param names - The names to search.
+ * @param matches - The pattern to search for.
  * @param invert - Iff true, invert the pattern.
- * @returns the submatrix.
+ * @returns the indices of the matching names, in order.
+ */
+static std::vector<matrix::size_type>
+grep_names(const name_table &names, const name_matcher &matches,
+		   bool invert)
+{
+	auto ret = std::vector<matrix::size_type>{};
+	for (size_t i = 0; i < names.size(); i++) {
+		if (matches(names[i]) ^ invert) {
+			ret.push_back(i);
+		}
+	}
+	return ret;
+}
+
+/** @brief Read a list of names separated by whitespace, usually one per line.
+ *
+ * @param file_name - The file to read.
+ * @returns the names in the order given, without repetitions.
+ */
+static name_table read_name_list(const std::string &file_name)
+{
+	auto file = std::ifstream{file_name};
+	if (!file) {
+		err(errno, "%s", file_name.c_str());
+	}
+
+	auto names = std::vector<std::string>{};
+	auto name = std::string{};
+	while (file >> name) {
+		names.push_back(name);
+	}
+
+	// drop repetitions, keeping the first occurrence
+	auto all = name_table(names);
+	auto first_occurrences = std::vector<name_table::size_type>{};
+	for (size_t i = 0; i < all.size(); i++) {
+		if (all.find(all[i]) == i) first_occurrences.push_back(i);
+	}
+
+	return name_table(all, first_occurrences);
+}
+
+/** @brief Find the names contained in a list.
+ *
+ * @param names - The names to search.
+ * @param list - The names to select.
+ * @param invert - Iff true, select the names not in the list.
+ * @param list_order - Iff true, return the names in the order of the list.
+ * Ignored when inverting.
+ * @returns the indices of the selected names.
  */
-matrix grep(const matrix &self, const std::regex &rpattern, bool invert)
+static std::vector<matrix::size_type>
+select_listed(const name_table &names, const name_table &list, bool invert,
+			  bool list_order)
 {
-	auto names = self.get_names();
+	auto ret = std::vector<matrix::size_type>{};
 
-	// remove all names that do not match the pattern
-	auto split =
-		std::remove_if(begin(names), end(names), [&](std::string &name) {
-			return !std::regex_search(name, rpattern) ^ invert;
-		});
+	if (list_order && !invert) {
+		for (auto name : list) {
+			auto index = names.find(name);
+			if (index != name_table::npos) ret.push_back(index);
+		}
+	} else {
+		for (size_t i = 0; i < names.size(); i++) {
+			if ((list.find(names[i]) != name_table::npos) ^ invert) {
+				ret.push_back(i);
+			}
+		}
+	}
 
-	// get the submatrix, so only the matching names and values remain
-	return sample2(self, begin(names), split);
+	return ret;
+}
+
+/** @brief Read labelled patterns. Each non-empty line holds a label,
+ * followed by whitespace and the pattern. Labels must be unique and must not
+ * contain a '/'.
+ *
+ * @param file_name - The file to read.
+ * @returns pairs of label and pattern.
+ */
+static std::vector<std::pair<std::string, std::string>>
+read_patterns(const std::string &file_name)
+{
+	auto file = std::ifstream{file_name};
+	if (!file) {
+		err(errno, "%s", file_name.c_str());
+	}
+
+	auto ret = std::vector<std::pair<std::string, std::string>>{};
+	auto labels = std::unordered_set<std::string>{};
+	auto line = std::string{};
+	auto line_number = size_t{0};
+	while (std::getline(file, line)) {
+		line_number++;
+
+		auto label_start = line.find_first_not_of(" \t\r");
+		if (label_start == std::string::npos) continue;
+
+		auto label_end = line.find_first_of(" \t", label_start);
+		auto pattern_start = line.find_first_not_of(" \t", label_end);
+		if (label_end == std::string::npos ||
+			pattern_start == std::string::npos) {
+			errx(EXIT_FAILURE, "%s:%zu: expected a label and a pattern",
+				 file_name.c_str(), line_number);
+		}
+
+		auto label = line.substr(label_start, label_end - label_start);
+		if (label.find('/') != std::string::npos) {
+			errx(EXIT_FAILURE, "%s:%zu: the label %s contains a '/'",
+				 file_name.c_str(), line_number, label.c_str());
+		}
+		// each label names an output file
+		if (!labels.insert(label).second) {
+			errx(EXIT_FAILURE, "%s:%zu: the label %s appears twice",
+				 file_name.c_str(), line_number, label.c_str());
+		}
+
+		auto pattern = line.substr(pattern_start);
+		if (!pattern.empty() && pattern.back() == '\r') pattern.pop_back();
+
+		ret.emplace_back(std::move(label), pattern);
+	}
+
+	return ret;
+}
+
+/** @brief Split matrices into one submatrix per pattern. The input is only
+ * parsed once; the submatrices are selected and written in parallel, one file
+ * per pattern.
+ *
+ * @param matrices - The matrices to split.
+ * @param patterns - Pairs of label and pattern.
+ * @param directory - Where to write the file LABEL.mat for each pattern.
+ * @param fast - Iff true, match simple patterns without std::regex.
+ * @param invert - Iff true, invert the patterns.
+ */
+static void
+split(const std::vector<matrix> &matrices,
+	  const std::vector<std::pair<std::string, std::string>> &patterns,
+	  const std::string &directory, bool fast, bool invert)
+{
+	if (mkdir(directory.c_str(), 0777) != 0 && errno != EEXIST) {
+		err(errno, "%s", directory.c_str());
+	}
+
+	// compile and open everything up front, so errors happen before any work
+	auto matchers = std::vector<name_matcher>{};
+	auto files = std::vector<std::ofstream>(patterns.size());
+	for (size_t k = 0; k < patterns.size(); k++) {
+		matchers.emplace_back(patterns[k].second, fast);
+
+		auto file_name = directory + "/" + patterns[k].first + ".mat";
+		files[k].open(file_name);
+		if (!files[k]) {
+			err(errno, "%s", file_name.c_str());
+		}
+	}
+
+#pragma omp parallel for schedule(dynamic)
+	for (size_t k = 0; k < patterns.size(); k++) {
+		for (const auto &mat : matrices) {
+			auto selected = grep_names(mat.get_names(), matchers[k], invert);
+			files[k] << format(matrix_view(mat, std::move(selected)));
+		}
+	}
 }
 
 static void mat_grep_usage(int status);
@@ -67,21 +306,53 @@ int mat_grep(int argc, char **argv)
 		{"file", required_argument, 0, 'f'},
 		{"help", no_argument, 0, 'h'},
 		{"invert-match", no_argument, 0, 'v'},
+		{"stream", no_argument, 0, 's'},
+		{"engine", required_argument, 0, 'e'},
+		{"names-from", required_argument, 0, 'n'},
+		{"list-order", no_argument, 0, 'l'},
+		{"split", required_argument, 0, 'S'},
+		{"output-dir", required_argument, 0, 'o'},
 		{0, 0, 0, 0}};
 
 	auto invert = false;
+	auto stream = false;
+	auto fast = true;
+	auto list_file = std::string{};
+	auto list_order = false;
+	auto split_file = std::string{};
+	auto output_dir = std::string{"."};
 
 	while (true) {
 		int option_index = 0;
-		int c = getopt_long(argc, argv, "f:hv", long_options, &option_index);
+		int c = getopt_long(argc, argv, "e:f:hln:o:sv", long_options,
+							&option_index);
 
 		if (c == -1)
 			break;
-		else if (c == 'f') {
+		else if (c == 'e') {
+			auto engine = std::string{optarg};
+			if (engine == "auto") {
+				fast = true;
+			} else if (engine == "regex") {
+				fast = false;
+			} else {
+				errx(EXIT_FAILURE, "unknown engine: %s", optarg);
+			}
+		} else if (c == 'f') {
 			file_names.push_back(optarg);
 		} else if (c == 'h')
 			mat_grep_usage(EXIT_SUCCESS);
-		else if (c == 'v') {
+		else if (c == 'l') {
+			list_order = true;
+		} else if (c == 'n') {
+			list_file = optarg;
+		} else if (c == 'o') {
+			output_dir = optarg;
+		} else if (c == 'S') {
+			split_file = optarg;
+		} else if (c == 's') {
+			stream = true;
+		} else if (c == 'v') {
 			invert = true;
 		} else
 			mat_grep_usage(EXIT_FAILURE);
@@ -89,20 +360,57 @@ int mat_grep(int argc, char **argv)
 
 	argc -= optind, argv += optind;
 
-	if (argc == 0) {
-		errx(EXIT_FAILURE, "missing pattern");
+	if (!split_file.empty()) {
+		if (stream || !list_file.empty()) {
+			errx(EXIT_FAILURE,
+				 "--split cannot be combined with --stream or --names-from");
+		}
+
+		auto patterns = read_patterns(split_file);
+		file_names.insert(file_names.end(), argv, argv + argc);
+		split(parse_all(file_names), patterns, output_dir, fast, invert);
+		return 0;
 	}
 
-	auto pattern = std::string{argv[0]};
-	argv++, argc--;
-	auto rpattern = std::regex(pattern);
+	auto select = name_selector{};
+	if (!list_file.empty()) {
+		auto list = read_name_list(list_file);
+		select = [=](const name_table &names) {
+			return select_listed(names, list, invert, list_order);
+		};
+	} else {
+		if (argc == 0) {
+			errx(EXIT_FAILURE, "missing pattern");
+		}
+
+		auto matches = name_matcher(argv[0], fast);
+		argv++, argc--;
+		select = [=](const name_table &names) {
+			return grep_names(names, matches, invert);
+		};
+	}
 
 	file_names.insert(file_names.end(), argv, argv + argc);
 
+	if (stream) {
+		if (file_names.empty()) {
+			file_names.push_back("-");
+		}
+
+		for (const auto &file_name : file_names) {
+			for (const auto &mat : parse_selected(file_name, select)) {
+				std::cout << format(mat);
+			}
+		}
+
+		return 0;
+	}
+
 	auto matrices = parse_all(file_names);
 
 	for (const auto &mat : matrices) {
-		std::cout << grep(mat, rpattern, invert).to_string();
+		// only the selected names and values remain
+		std::cout << format(matrix_view(mat, select(mat.get_names())));
 	}
 
 	return 0;
@@ -112,11 +420,30 @@ static void mat_grep_usage(int status)
 {
 	static const char str[] = {
 		"usage: mat grep [OPTIONS] PATTERN [FILE...]\n"
+		"       mat grep [OPTIONS] --names-from LIST [FILE...]\n"
+		"       mat grep [OPTIONS] --split PATTERNS [FILE...]\n"
 		"Print submatrix for names matching the PATTERN.\n"
 		"The PATTERN can be a regular expression using ECMAScript format.\n\n"
 		"Available options:\n"
+		"  -e, --engine ENGINE  'regex' always uses std::regex; 'auto' matches "
+		"plain\n"
+		"                       strings, optionally anchored by ^ or $, "
+		"directly;\n"
+		"                       default: auto\n"
 		"  -f, --file FILE      read the matrix from FILE\n"
 		"  -h, --help           print this help\n"
+		"  -l, --list-order     with --names-from, order names as in the "
+		"list\n"
+		"  -n, --names-from LIST\n"
+		"                       select the names in the file LIST instead of "
+		"using a\n"
+		"                       PATTERN\n"
+		"  -o, --output-dir DIR with --split, write the files to DIR; "
+		"default: .\n"
+		"  -s, --stream         only parse the values of matching rows\n"
+		"      --split PATTERNS for each line 'LABEL PATTERN' in the file "
+		"PATTERNS\n"
+		"                       write the submatrix to LABEL.mat\n"
 		"  -v, --invert-match   select non-matching names\n"};
 
 	fprintf(status == EXIT_SUCCESS ? stdout : stderr, str);
@@ -13,12 +13,15 @@
  * You should have received a copy of the GNU General Public License
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
+#include <algorithm>
+#include <cassert>
 #include <cmath>
 #include <cstdio>
 #include <err.h>
 #include <getopt.h>
 #include <iostream>
 #include <iterator>
+#include <numeric>
 #include <random>
 #include <string>
 #include <type_traits>
@@ -39,147 +42,400 @@ auto ProperlySeededRandomEngine() -> typename std::enable_if<!!N, T>::type
 	return seededEngine;
 }
 
-double lower_triangle_avg(const matrix &self)
-{
-	double ret = 0;
+enum class statistic { rmsd, pearson, spearman };
 
+static const size_t PERMUTATIONS = 100000;
+
+/** @brief Copy the lower triangle of a matrix into a packed vector, row by
+ * row.
+ *
+ * @param self - The matrix.
+ * @returns the values below the main diagonal.
+ */
+std::vector<double> packed_lower_triangle(const matrix &self)
+{
 	auto size = self.get_size();
-	for (size_t i = 0; i < size; i++) {
-		for (size_t j = 0; j < i; j++) {
-			ret += self.entry(i, j);
-		}
+	auto ret = std::vector<double>();
+	ret.reserve(size * (size - 1) / 2);
+
+	for (size_t i = 1; i < size; i++) {
+		ret.insert(ret.end(), self.row(i), self.row(i) + i);
 	}
 
-	double count = size * (size - 1) / 2.0;
-	return ret / count;
+	return ret;
 }
 
-double lower_triangle_avg_it(const matrix &self)
+/** @brief Replace all values of the lower triangle by their rank. Ties get
+ * their average rank. The upper triangle is mirrored accordingly.
+ *
+ * @param self - The matrix to rank in place.
+ */
+void rank_lower_triangle(matrix &self)
 {
-	auto ret = std::accumulate(begin_lower_triangle(self),
-							   end_lower_triangle(self), 0.0);
-
 	auto size = self.get_size();
-	double count = size * (size - 1) / 2.0;
-	return ret / count;
+	auto values = packed_lower_triangle(self);
+	auto order = std::vector<size_t>(values.size());
+	std::iota(begin(order), end(order), 0);
+	std::sort(begin(order), end(order),
+			  [&](size_t a, size_t b) { return values[a] < values[b]; });
+
+	auto ranks = std::vector<double>(values.size());
+	for (size_t k = 0; k < order.size();) {
+		auto l = k + 1;
+		while (l < order.size() && values[order[l]] == values[order[k]]) {
+			l++;
+		}
+		// ranks are one-based, ties share the average
+		auto rank = (k + l + 1) / 2.0;
+		for (; k < l; k++) {
+			ranks[order[k]] = rank;
+		}
+	}
+
+	auto rank_it = ranks.cbegin();
+	for (size_t i = 1; i < size; i++) {
+		for (size_t j = 0; j < i; j++) {
+			self.entry(i, j) = self.entry(j, i) = *rank_it++;
+		}
+	}
 }
 
-double lower_triangle_stddvt(const matrix &self, double avg)
-{
-	auto sum =
-		std::accumulate(begin_lower_triangle(self), end_lower_triangle(self),
-						0.0, [=](double sum, double value) {
-							auto t = value - avg;
-							return sum + t * t;
-						});
+/** @brief The sum and the sum of squares of the lower triangle. These suffice
+ * to center the values and to detect constant matrices. */
+struct moments {
+	double count = 0;
+	double sum = 0;
+	double sum_sq = 0;
+
+	moments() = default;
+	explicit moments(const std::vector<double> &values)
+		: count(values.size()), sum{}, sum_sq{}
+	{
+		for (auto value : values) {
+			sum += value;
+			sum_sq += value * value;
+		}
+	}
 
-	auto size = self.get_size();
-	double count = size * (size - 1) / 2.0 - 1;
-	return std::sqrt(sum / count);
-}
+	double mean() const noexcept
+	{
+		return sum / count;
+	}
 
-matrix normalize(const matrix &self)
+	/** The centered sum of squares. */
+	double ss() const noexcept
+	{
+		return sum_sq - sum * sum / count;
+	}
+};
+
+/** @brief Compute Σ xᵢⱼ·y_π(i)π(j) over the lower triangle.
+ *
+ * @param x - The packed lower triangle of the first matrix.
+ * @param y - The second matrix.
+ * @param perm - The permutation to apply to the rows and columns of y.
+ * @returns the cross-product.
+ */
+double cross_product(const std::vector<double> &x, const matrix &y,
+					 const std::vector<size_t> &perm)
 {
-	auto ret = self;
-	auto avg = lower_triangle_avg(self);
-	auto sd = lower_triangle_stddvt(self, avg);
-	auto begin = begin_square(ret);
-	auto end = end_square(ret);
+	double ret = 0;
+	auto x_it = x.data();
 
-	std::transform(begin, end, begin,
-				   [=](double value) { return (value - avg) / sd; });
+	auto size = y.get_size();
+	for (size_t i = 1; i < size; i++) {
+		auto row = y.row(perm[i]);
+		for (size_t j = 0; j < i; j++) {
+			ret += *x_it++ * row[perm[j]];
+		}
+	}
 
 	return ret;
 }
 
-double Z(const matrix &self, const matrix &other)
+/** @brief Compute the requested statistic from two aligned lower triangles.
+ * The permutations only compare cross-products, but expanding the statistic
+ * from a cross-product cancels catastrophically for similar matrices. So the
+ * reported value is computed directly.
+ *
+ * Pearson's r is Σ(x - x̄)(y - ȳ) / √(Σ(x - x̄)²·Σ(y - ȳ)²). The RMSD is
+ * √(Σ(x - y)² / n), with z-scores if the matrices are to be normalized.
+ * Spearman's ρ is Pearson's r computed on ranks.
+ *
+ * @param x - The packed lower triangle of the first matrix.
+ * @param mx - Its moments.
+ * @param y - The packed lower triangle of the second matrix.
+ * @param my - Its moments.
+ * @returns the statistic.
+ */
+double apply_statistic(statistic stat, bool donormalize,
+					   const std::vector<double> &x, const moments &mx,
+					   const std::vector<double> &y, const moments &my)
 {
-	auto names = common_names(self.get_names(), other.get_names());
+	assert(x.size() == y.size());
+	auto n = mx.count;
+	auto x_mean = mx.mean(), y_mean = my.mean();
+
+	if (stat == statistic::rmsd && !donormalize) {
+		double sum = 0;
+		for (size_t k = 0; k < x.size(); k++) {
+			auto t = x[k] - y[k];
+			sum += t * t;
+		}
+		return std::sqrt(sum / n);
+	}
 
-	double dist = 0;
+	double sxx = 0, syy = 0, sxy = 0;
+	for (size_t k = 0; k < x.size(); k++) {
+		auto dx = x[k] - x_mean, dy = y[k] - y_mean;
+		sxx += dx * dx;
+		syy += dy * dy;
+		sxy += dx * dy;
+	}
 
-	for (size_t i = 0; i < names.size() - 1; i++) {
-		const auto &name1 = names[i];
-		for (size_t j = i + 1; j < names.size(); j++) {
-			const auto &name2 = names[j];
-			auto d1 = self.entry(name1, name2);
-			auto d2 = other.entry(name1, name2);
-			dist += d1 * d2;
-		}
+	if (stat != statistic::rmsd) {
+		return sxy / std::sqrt(sxx * syy);
 	}
 
-	return dist;
+	// z-scores use the sample standard deviation
+	auto sdx = std::sqrt(sxx / (n - 1));
+	auto sdy = std::sqrt(syy / (n - 1));
+	double sum = 0;
+	for (size_t k = 0; k < x.size(); k++) {
+		auto t = (x[k] - x_mean) / sdx - (y[k] - y_mean) / sdy;
+		sum += t * t;
+	}
+	return std::sqrt(sum / n);
 }
 
-double rmsd(const matrix &self, const matrix &other)
+struct mantel_result {
+	double statistic;
+	double p_value;
+};
+
+/** @brief A matrix prepared for the Mantel test. It is aligned by sorted
+ * names, ranked if necessary, and its moments are precomputed. Computing this
+ * once per matrix allows for reuse in all comparisons. */
+struct mantel_data {
+	std::vector<std::string> names;
+	matrix aligned;
+	std::vector<double> packed;
+	moments stats;
+};
+
+/** @brief Prepare a matrix for the Mantel test.
+ *
+ * @param self - The matrix.
+ * @param names - The sorted names to sample.
+ * @param stat - The statistic to use.
+ * @returns the aligned matrix.
+ */
+mantel_data prepare(const matrix &self, const std::vector<std::string> &names,
+					statistic stat)
 {
-	const auto &names = self.get_names();
-
-	double dist = 0;
-
-	for (size_t i = 0; i < names.size() - 1; i++) {
-		const auto &name1 = names[i];
-		for (size_t j = i + 1; j < names.size(); j++) {
-			const auto &name2 = names[j];
-			auto d1 = self.entry(name1, name2);
-			auto d2 = other.entry(name1, name2);
-			auto t = d1 - d2;
-			dist += t * t;
-		}
+	auto ret = mantel_data{};
+	ret.names = names;
+	ret.aligned = sample2(self, names.begin(), names.end());
+
+	if (stat == statistic::spearman) {
+		rank_lower_triangle(ret.aligned);
 	}
 
-	auto count = names.size() * (names.size() - 1) / 2.0;
-	return std::sqrt(dist / count);
+	ret.packed = packed_lower_triangle(ret.aligned);
+	ret.stats = moments(ret.packed);
+	return ret;
 }
 
-double mantel(const matrix &self, const matrix &other, bool donormalize)
+mantel_data prepare(const matrix &self, statistic stat)
+{
+	const auto &table = self.get_names();
+	auto names = std::vector<std::string>(table.begin(), table.end());
+	std::sort(begin(names), end(names));
+	return prepare(self, names, stat);
+}
+
+/** @brief Perform a Mantel test on the common submatrix of two matrices.
+ *
+ * All supported statistics are monotonic in the cross-product of the two
+ * lower triangles; a larger cross-product means a better fit. Hence, each
+ * permutation only computes that cross-product and compares it to the
+ * original one.
+ *
+ * @param self - One prepared matrix.
+ * @param other - The other prepared matrix.
+ * @param stat - The statistic to report.
+ * @param donormalize - Use z-scores for the RMSD.
+ * @returns the statistic and its p-value.
+ */
+mantel_result mantel(const mantel_data &self, const mantel_data &other,
+					 statistic stat, bool donormalize)
 {
 	using std::begin;
 	using std::end;
-	auto new_names = common_names(self.get_names(), other.get_names());
 
-	auto size = new_names.size();
-	auto new_self = sample2(self, new_names.begin(), new_names.end());
-	auto new_other = sample2(other, new_names.begin(), new_names.end());
+	if (self.names != other.names) {
+		// Ranks of a subset are the ranks of the subset of ranks. So
+		// resampling the prepared matrices is fine for all statistics.
+		auto new_names = common_names(self.names, other.names);
+		return mantel(prepare(self.aligned, new_names, stat),
+					  prepare(other.aligned, new_names, stat), stat,
+					  donormalize);
+	}
+
+	auto size = self.names.size();
+	if (size < 3) {
+		errx(1, "The matrices need at least three names in common.");
+	}
 
-	if (donormalize) {
-		new_self = normalize(new_self);
-		new_other = normalize(new_other);
+	// correlations and z-scores are undefined for constant matrices
+	if (stat != statistic::rmsd || donormalize) {
+		if (!(self.stats.ss() > 0) || !(other.stats.ss() > 0)) {
+			errx(1, "Cannot compute the statistic of a constant matrix.");
+		}
 	}
 
-	auto orig = rmsd(new_self, new_other);
-	std::cout << "orig: " << orig << std::endl;
+	const auto &x = self.packed;
+	const auto &y = other.aligned;
 
-	auto montecarlo = std::vector<double>();
 	auto indices = std::vector<size_t>(size);
 	std::iota(begin(indices), end(indices), 0);
 
-	auto g = ProperlySeededRandomEngine();
+	auto orig = cross_product(x, y, indices);
+	auto value = apply_statistic(stat, donormalize, x, self.stats,
+								 other.packed, other.stats);
+	if (std::isnan(value)) {
+		// a NaN never compares, so the p-value would be meaningless
+		errx(1, "The statistic is not a number.");
+	}
 
-	auto count = size * (size - 1) / 2.0;
+	auto g = ProperlySeededRandomEngine();
+	size_t at_least_as_good = 0;
 
-	for (size_t runs = 0; runs < 100000; runs++) {
+	for (size_t runs = 0; runs < PERMUTATIONS; runs++) {
 		std::shuffle(begin(indices), end(indices), g);
-		// randomize
-		double dist = 0;
-
-		for (size_t i = 0; i < size - 1; i++) {
-			for (size_t j = i + 1; j < size; j++) {
-				auto d1 = new_self.entry(i, j);
-				auto d2 = new_other.entry(indices[i], indices[j]);
-				auto t = d1 - d2;
-				dist += t * t;
-			}
+		if (cross_product(x, y, indices) >= orig) {
+			at_least_as_good++;
 		}
+	}
+
+	return {value, at_least_as_good / (double)PERMUTATIONS};
+}
 
-		std::cerr << "Z: " << std::sqrt(dist / count) << std::endl;
-		montecarlo.push_back(std::sqrt(dist / count));
+/** @brief Regress the lower triangle of a matrix on the one of a control
+ * matrix and keep only the residuals.
+ *
+ * @param self - The prepared matrix.
+ * @param control - The prepared control matrix with the same names.
+ * @returns the prepared residual matrix.
+ */
+mantel_data residuals(const mantel_data &self, const mantel_data &control)
+{
+	assert(self.names == control.names);
+	const auto &x = self.packed;
+	const auto &z = control.packed;
+	auto n = self.stats.count;
+	auto mx = self.stats.mean();
+	auto mz = control.stats.mean();
+
+	if (!(control.stats.ss() > 0)) {
+		errx(1, "The control matrix is constant; cannot regress on it.");
 	}
 
-	std::sort(begin(montecarlo), end(montecarlo));
-	auto it = std::lower_bound(begin(montecarlo), end(montecarlo), orig);
+	auto sxz = std::inner_product(x.begin(), x.end(), z.begin(), 0.0);
+	auto slope = (sxz - n * mx * mz) / control.stats.ss();
+
+	auto ret = mantel_data{};
+	ret.names = self.names;
+	ret.aligned = self.aligned;
+	ret.packed.resize(x.size());
+
+	auto size = self.names.size();
+	size_t k = 0;
+	for (size_t i = 1; i < size; i++) {
+		for (size_t j = 0; j < i; j++, k++) {
+			auto residual = x[k] - mx - slope * (z[k] - mz);
+			ret.packed[k] = residual;
+			ret.aligned.entry(i, j) = ret.aligned.entry(j, i) = residual;
+		}
+	}
 
-	return (end(montecarlo) - it) / (double)montecarlo.size();
+	ret.stats = moments(ret.packed);
+	return ret;
+}
+
+/** @brief Perform a partial Mantel test of two matrices, controlling for a
+ * third one. The effect of the control matrix is removed from both matrices
+ * by linear regression. The residual matrices are then compared via their
+ * Pearson correlation, which is the partial correlation.
+ *
+ * @param self - One matrix.
+ * @param other - The other matrix.
+ * @param control - The control matrix.
+ * @param stat - Either pearson or spearman.
+ * @returns the partial correlation and its p-value.
+ */
+mantel_result partial_mantel(const matrix &self, const matrix &other,
+							 const matrix &control, statistic stat)
+{
+	auto new_names = common_names(
+		common_names(self.get_names(), other.get_names()), control.get_names());
+	if (new_names.size() < 3) {
+		errx(1, "The matrices and the control need at least three names in "
+				"common.");
+	}
+
+	auto prepared_control = prepare(control, new_names, stat);
+	auto self_residuals =
+		residuals(prepare(self, new_names, stat), prepared_control);
+	auto other_residuals =
+		residuals(prepare(other, new_names, stat), prepared_control);
+
+	return mantel(self_residuals, other_residuals, statistic::pearson, false);
+}
+
+/** @brief Compare all matrices with each other. Only one test per unordered
+ * pair is performed and the pairs are distributed among all threads.
+ *
+ * @param matrices - The matrices to compare.
+ * @param stat - The statistic to use.
+ * @param donormalize - Use z-scores for the RMSD.
+ * @returns a matrix of p-values.
+ */
+matrix mantel_all(const std::vector<matrix> &matrices, statistic stat,
+				  bool donormalize)
+{
+	auto size = matrices.size();
+	auto names = std::vector<std::string>();
+	names.reserve(size);
+
+	// come up with a new name for each matrix
+	for (size_t i = 1; i <= size; i++) {
+		names.push_back(std::string("M") + std::to_string(i));
+	}
+
+	auto prepared = std::vector<mantel_data>(size);
+#pragma omp parallel for schedule(dynamic)
+	for (size_t i = 0; i < size; i++) {
+		prepared[i] = prepare(matrices[i], stat);
+	}
+
+	auto pairs = std::vector<std::pair<size_t, size_t>>();
+	pairs.reserve(size * (size - 1) / 2);
+	for (size_t i = 1; i < size; i++) {
+		for (size_t j = 0; j < i; j++) {
+			pairs.emplace_back(i, j);
+		}
+	}
+
+	auto ret = matrix{names, std::vector<double>(size * size)};
+#pragma omp parallel for schedule(dynamic)
+	for (size_t k = 0; k < pairs.size(); k++) {
+		auto i = pairs[k].first, j = pairs[k].second;
+		ret.entry(i, j) = ret.entry(j, i) =
+			mantel(prepared[i], prepared[j], stat, donormalize).p_value;
+	}
+
+	return ret;
 }
 
 static void mat_mantel_usage(int status);
@@ -197,15 +453,19 @@ int mat_mantel(int argc, char **argv)
 		{"help", no_argument, 0, 0},   // print help
 		{"full", no_argument, 0, 'f'}, // full matrix
 		{"normalize", no_argument, 0, 'n'},
+		{"partial", required_argument, 0, 'p'},
+		{"statistic", required_argument, 0, 's'},
 		{0, 0, 0, 0} //
 	};
 
 	bool full_matrix = false;
 	bool donormalize = false;
+	auto stat = statistic::rmsd;
+	auto control_file_name = std::string();
 
 	while (true) {
 		int long_index;
-		int c = getopt_long(argc, argv, "fn", long_options, &long_index);
+		int c = getopt_long(argc, argv, "fnp:s:", long_options, &long_index);
 
 		if (c == -1) {
 			break;
@@ -222,6 +482,20 @@ int mat_mantel(int argc, char **argv)
 			}
 			case 'f': full_matrix = true; break;
 			case 'n': donormalize = true; break;
+			case 'p': control_file_name = optarg; break;
+			case 's': {
+				auto stat_string = std::string(optarg);
+				if (stat_string == "rmsd") {
+					stat = statistic::rmsd;
+				} else if (stat_string == "pearson") {
+					stat = statistic::pearson;
+				} else if (stat_string == "spearman") {
+					stat = statistic::spearman;
+				} else {
+					errx(1, "unknown statistic '%s'.", optarg);
+				}
+				break;
+			}
 			default: /* intentional fall-through */
 			case '?': mat_mantel_usage(EXIT_FAILURE);
 		}
@@ -235,30 +509,31 @@ int mat_mantel(int argc, char **argv)
 		errx(1, "At least two matrices must be provided.");
 	}
 
-	if (!full_matrix) {
-		std::cout << mantel(matrices[0], matrices[1], donormalize) << std::endl;
-	} else {
-		// compute a full distance matrix
-		auto size = matrices.size();
-		auto names = std::vector<std::string>();
-		auto values = std::vector<double>(size * size);
-		names.reserve(size);
-
-		// come up with a new name for each matrix
-		for (size_t i = 1; i <= size; i++) {
-			names.push_back(std::string("M") + std::to_string(i));
+	if (!control_file_name.empty()) {
+		if (full_matrix) {
+			errx(1, "A partial test cannot produce a full matrix.");
 		}
 
-		auto cmpmat = matrix{names, values};
-		for (size_t i = 0; i < size; i++) {
-			for (size_t j = 0; j < size; j++) {
-				if (i == j) continue;
-				cmpmat.entry(i, j) = cmpmat.entry(j, i) =
-					mantel(matrices[i], matrices[j], donormalize);
-			}
+		auto controls = parse(control_file_name);
+		if (controls.size() != 1) {
+			errx(1, "The control file must contain exactly one matrix.");
+		}
+
+		// a partial test always reports the (rank) correlation
+		if (stat == statistic::rmsd) {
+			stat = statistic::pearson;
 		}
 
-		std::cout << cmpmat.to_string();
+		auto result =
+			partial_mantel(matrices[0], matrices[1], controls[0], stat);
+		std::cout << result.statistic << "\t" << result.p_value << std::endl;
+	} else if (!full_matrix) {
+		auto result = mantel(prepare(matrices[0], stat),
+							 prepare(matrices[1], stat), stat, donormalize);
+		std::cout << result.statistic << "\t" << result.p_value << std::endl;
+	} else {
+		// compute a full distance matrix
+		std::cout << mantel_all(matrices, stat, donormalize).to_string();
 	}
 
 	return 0;
@@ -270,7 +545,10 @@ static void mat_mantel_usage(int status)
 		"usage: mat mantel [OPTIONS] [FILE...]\n" // this comment is a hack
 		"Compare matrices using the mantel test.\n\n"
 		"Available options:\n"
-		" -f, --full          output a full distance matrix\n"
+		" -f, --full          output a full distance matrix of p-values\n"
+		" -n, --normalize     use z-scores for the RMSD\n"
+		" -p, --partial FILE  control for the matrix in FILE\n"
+		" -s, --statistic <s> use rmsd (default), pearson or spearman\n"
 		"     --help          print this help\n"};
 
 	fprintf(status == EXIT_SUCCESS ? stdout : stderr, str);
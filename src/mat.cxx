@@ -17,6 +17,7 @@
 #include <stdio.h>
 #include <string>
 
+int mat_combine(int, char **);
 int mat_compare(int, char **);
 int mat_diff(int, char **);
 int mat_grep(int, char **);
@@ -53,6 +54,10 @@ int main(int argc, char *argv[])
 	argc -= 1, argv += 1;
 
 	auto command = first_arg;
+	if (command == "combine") {
+		return mat_combine(argc, argv);
+	}
+
 	if (command == "compare") {
 		return mat_compare(argc, argv);
 	}
@@ -88,6 +93,7 @@ static void usage(int status)
 	static const char str[] = {
 		"usage: mat [--version] [--help] <command> [<args>]\n\n"
 		"The available commands are:\n"
+		" combine     Combine matrices, respecting coverages\n"
 		" compare     Compute the distance between two matrices\n"
 		" format      Format the distance matrix\n"
 		" grep        Print submatrix for names matching a pattern\n"
@@ -15,38 +15,70 @@
  */
 #include "matrix.h"
 #include <algorithm>
+#include <cctype>
+#include <cstdlib>
+#include <cstring>
 #include <err.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <fstream>
 #include <iostream>
+#include <iterator>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <tuple>
+#include <unistd.h>
 #include <vector>
 // #include <boost/config/warning_disable.hpp>
 #include <boost/spirit/home/x3.hpp>
 #include <boost/spirit/include/support_istream_iterator.hpp>
 
+/**
+ * @brief Print a single row of a matrix. See format() for the parameters.
+ *
+ * @param out - The string to append to.
+ * @param name - The name of the row.
+ * @param values - The values to print.
+ * @param count - The number of values.
+ */
+void format_row(std::string &out, std::string_view name,
+				const double *values, size_t count, char separator,
+				const char *format_specifier, bool truncate_names)
+{
+	auto name_length = truncate_names ? std::min<size_t>(name.size(), 10)
+									  : name.size();
+
+	char buf[100];
+	buf[0] = '\0';
+
+	snprintf(buf, 100, "%-10.*s", int(name_length), name.data());
+	out += buf;
+	for (size_t j = 0; j < count; j++) {
+		out += separator;
+		snprintf(buf, 100, format_specifier, values[j]);
+		out += buf;
+	}
+	out += "\n";
+}
+
 /**
  * @brief Print the given matrix into a string. Allows for modified formatting.
  *
  * The default for format_specifier is chosen, so that four significant digits
  * are displayed and NaNs are right-aligned.
  *
- * @param self - The matrix to be printed.
+ * @param self - The (view of a) matrix to be printed.
  * @param separator - The character printed in between two cells.
  * @param format_specifier - A printf-style format specifier
  * @returns the formatted string
  */
-std::string format(const matrix &self, char separator = ' ',
-				   const char *format_specifier = "%9.3e",
-				   bool truncate_names = false)
+std::string format(const matrix_view &self, char separator,
+				   const char *format_specifier, bool truncate_names)
 {
 	std::string ret{};
 	auto size = self.get_size();
-	const auto &names = self.get_names();
-	auto name_format = truncate_names ? "%-10.10s" : "%-10s";
+	auto row = std::vector<double>(size); // buffer for permuted rows
 
-	char buf[100];
-	buf[0] = '\0';
 	// a rough estimate of the resulting string size
 	ret.reserve(size * 10 + size * size * 5 + size);
 
@@ -54,19 +86,20 @@ std::string format(const matrix &self, char separator = ' ',
 	ret += "\n";
 
 	for (size_t i = 0; i < size; i++) {
-		snprintf(buf, 100, name_format, names[i].c_str());
-		ret += buf;
-		for (size_t j = 0; j < size; j++) {
-			ret += separator;
-			snprintf(buf, 100, format_specifier, self.entry(i, j));
-			ret += buf;
-		}
-		ret += "\n";
+		format_row(ret, self.name(i), self.row(i, row.data()), size,
+				   separator, format_specifier, truncate_names);
 	}
 
 	return ret;
 }
 
+std::string format(const matrix &self, char separator,
+				   const char *format_specifier, bool truncate_names)
+{
+	return format(matrix_view(self), separator, format_specifier,
+				  truncate_names);
+}
+
 /** @brief Convert a matrix into a human-readable string (phylip format).
  *
  * @returs a string representing the matrix.
@@ -114,6 +147,84 @@ auto parse_line_spirit(const std::string &file_name, ForwardIt &first,
 	return std::make_pair(name, values);
 }
 
+/** @brief Parse the block of coverages following a distance matrix. It
+ * consists of rows of values without names, in the same format as the
+ * matrix.
+ *
+ * @param file_name - The current file, for error messages.
+ * @param size - The size of the matrix.
+ * @param lower_triangle - True iff the rows are in lower triangle format.
+ * @param diagonal_values - True iff lower triangle rows include the diagonal.
+ *
+ * @returns the coverages as a packed lower triangle. Cells above the diagonal
+ * are assumed to mirror the ones below and are skipped.
+ */
+template <typename ForwardIt>
+auto parse_coverages(const std::string &file_name, ForwardIt &first,
+					 ForwardIt &last, size_t size, bool lower_triangle,
+					 bool diagonal_values)
+{
+	using namespace boost::spirit::x3;
+
+	auto coverages = std::vector<float>(matrix::triangle_size(size));
+
+	for (size_t i = 0; i < size; i++) {
+		auto line_length = lower_triangle ? i + size_t(diagonal_values) : size;
+		auto row = coverages.begin() + matrix::triangle_index(i, 0);
+		size_t count = 0;
+
+		auto push_back = [&](const auto &ctx) {
+			_pass(ctx) = count < line_length;
+			if (_pass(ctx)) {
+				if (count <= i) {
+					row[count] = _attr(ctx);
+				}
+				count++;
+			}
+		};
+
+		const auto values_rule = double_[push_back] % *blank;
+		const auto line_rule = omit[*blank] >> -values_rule >> omit[*space];
+
+		if (!parse(first, last, line_rule)) {
+			errx(1, "%s: parse error in coverages", file_name.c_str());
+		}
+	}
+
+	return coverages;
+}
+
+/** @brief Parse the line stating the size of a matrix.
+ *
+ * @param file_name - The file name, for error messages
+ * @returns the size
+ */
+template <typename InputIt>
+size_t parse_size(const std::string &file_name, InputIt &first, InputIt &last)
+{
+	using namespace boost::spirit::x3;
+
+	size_t size = 0;
+	const auto size_rule = omit[*blank] >> long_;
+	bool r = parse(first, last, size_rule >> eol, size);
+
+	if (!r) {
+		errx(1, "%s: failed to read matrix size", file_name.c_str());
+	}
+
+	if (size == 0) {
+		errx(1, "%s: matrix of size 0", file_name.c_str());
+	}
+
+	// prevent overflow
+	static const auto MAX_SIZE = (size_t(1) << ((sizeof(size_t) >> 1) * 4)) - 1;
+	if (size > MAX_SIZE) {
+		errx(EINVAL, "%s: given matrix size is too big", file_name.c_str());
+	}
+
+	return size;
+}
+
 /** @brief Parse a distance matrix from full or lower triangle format.
  *
  * The *phylip distance matrix* is a poorly defined file format. It exists in
@@ -145,25 +256,7 @@ template <typename InputIt>
 matrix parse_tolerant_internal(const std::string &file_name, InputIt &first,
 							   InputIt &last)
 {
-	using namespace boost::spirit::x3;
-
-	size_t size = 0;
-	const auto size_rule = omit[*blank] >> long_;
-	bool r = parse(first, last, size_rule >> eol, size);
-
-	if (!r) {
-		errx(1, "%s: failed to read matrix size", file_name.c_str());
-	}
-
-	if (size == 0) {
-		errx(1, "%s: matrix of size 0", file_name.c_str());
-	}
-
-	// prevent overflow
-	static const auto MAX_SIZE = (size_t(1) << ((sizeof(size_t) >> 1) * 4)) - 1;
-	if (size > MAX_SIZE) {
-		errx(EINVAL, "%s: given matrix size is too big", file_name.c_str());
-	}
+	auto size = parse_size(file_name, first, last);
 
 	auto names = std::vector<std::string>{};
 	auto values = std::vector<double>(size * size);
@@ -199,7 +292,24 @@ matrix parse_tolerant_internal(const std::string &file_name, InputIt &first,
 				  values.begin() + i * size);
 	}
 
-	auto ret = matrix{names, values};
+	auto ret = matrix{};
+
+	// optionally, the matrix is followed by its coverages
+	using boost::spirit::x3::lit;
+	using boost::spirit::x3::space;
+	if (boost::spirit::x3::parse(first, last, lit("Coverages:") >> *space)) {
+		auto coverages = parse_coverages(file_name, first, last, size,
+										 lower_triangle, diagonal_values);
+		ret = matrix{names, std::move(values), std::move(coverages)};
+	} else {
+		ret = matrix{names, std::move(values)};
+	}
+
+	if (ret.has_duplicate_names()) {
+		auto duplicate = ret.duplicate_name();
+		errx(1, "%s: the name %.*s appears twice.", file_name.c_str(),
+			 int(duplicate.size()), duplicate.data());
+	}
 
 	if (lower_triangle) {
 		// fix upper triangle
@@ -213,16 +323,15 @@ matrix parse_tolerant_internal(const std::string &file_name, InputIt &first,
 	return ret;
 }
 
-/** @brief Parse the first matrix from a file and write it to a structure.
+/** @brief Open a file for parsing. A file name of "-" denotes stdin.
  *
- * @param file_name - The file to read.
- * @param out - An output iterator we write the matrices to.
- * @returns the position one past the last written matrix.
+ * @param file_name - The file to open.
+ * @param file - The file stream to use.
+ * @returns the input stream.
  */
-template <typename OutputIt>
-OutputIt parse_tolerant(const std::string &file_name, OutputIt out)
+static std::istream *open_input(const std::string &file_name,
+								std::ifstream &file)
 {
-	std::ifstream file;
 	std::istream *input = &std::cin;
 
 	if (file_name != "-") {
@@ -235,6 +344,108 @@ OutputIt parse_tolerant(const std::string &file_name, OutputIt out)
 		err(errno, "%s", file_name.c_str());
 	}
 
+	return input;
+}
+
+struct row_reader::impl {
+	std::string file_name;
+	std::ifstream file;
+	std::istream *input;
+	boost::spirit::istream_iterator first, last;
+
+	size_t size = 0;
+	size_t row = 0;
+	bool lower_triangle = false;
+	bool diagonal_values = false;
+
+	explicit impl(std::string _file_name)
+		: file_name{std::move(_file_name)}, file{},
+		  input{open_input(file_name, file)}, first{*input}, last{}
+	{
+	}
+};
+
+row_reader::row_reader(const std::string &file_name)
+	: pimpl{std::make_unique<impl>(file_name)}
+{
+}
+
+row_reader::~row_reader() = default;
+
+bool row_reader::next_matrix()
+{
+	auto &self = *pimpl;
+	if (!self.input->good() || self.input->eof() || self.first == self.last) {
+		return false;
+	}
+
+	self.size = parse_size(self.file_name, self.first, self.last);
+	self.row = 0;
+	return true;
+}
+
+auto row_reader::get_size() const noexcept -> size_type
+{
+	return pimpl->size;
+}
+
+bool row_reader::next_row(std::string &name, std::vector<double> &values)
+{
+	auto &self = *pimpl;
+	if (self.row >= self.size) {
+		return false;
+	}
+
+	auto line_length = self.size;
+	if (self.row > 0 && self.lower_triangle) {
+		line_length = self.row + size_t(self.diagonal_values);
+	}
+
+	auto line =
+		parse_line_spirit(self.file_name, self.first, self.last, line_length);
+
+	// the first line determines the format, see parse_tolerant_internal()
+	if (self.row == 0) {
+		self.lower_triangle = line.second.size() < self.size;
+		self.diagonal_values =
+			self.lower_triangle && line.second.size() == 1;
+	}
+
+	name = std::move(line.first);
+	values = std::move(line.second);
+	// missing values are zero
+	values.resize(std::max(values.size(), self.row), 0.0);
+	self.row++;
+
+	// skip the coverages, if any; empty rows have no line of their own
+	if (self.row == self.size) {
+		using namespace boost::spirit::x3;
+		if (parse(self.first, self.last, lit("Coverages:") >> *space)) {
+			const auto line_rule = omit[*(char_ - eol)] >> omit[*space];
+			for (size_t i = 0; i < self.size && self.first != self.last; i++) {
+				auto length = self.lower_triangle
+								  ? i + size_t(self.diagonal_values)
+								  : self.size;
+				if (length > 0) parse(self.first, self.last, line_rule);
+			}
+		}
+	}
+
+	return true;
+}
+
+/** @brief Parse the first matrix from a file and write it to a structure.
+ *
+ * @param file_name - The file to read.
+ * @param out - An output iterator we write the matrices to.
+ * @returns the position one past the last written matrix.
+ */
+template <typename OutputIt>
+OutputIt parse_tolerant(const std::string &file_name, OutputIt out)
+{
+	std::ifstream file;
+	auto input = open_input(file_name, file);
+
 	boost::spirit::istream_iterator first(*input), last;
 
 	if (input->eof()) {
@@ -248,6 +459,24 @@ OutputIt parse_tolerant(const std::string &file_name, OutputIt out)
 	return out;
 }
 
+/**
+ * @brief Parse a nonnegative integer option argument. Errors are fatal.
+ *
+ * @param str - The argument.
+ * @param option - The option name, for error messages.
+ * @returns the number.
+ */
+size_t parse_count(const char *str, const char *option)
+{
+	char *end = nullptr;
+	errno = 0;
+	auto ret = strtoul(str, &end, 10);
+	if (end == str || *end != '\0' || errno != 0 || strchr(str, '-')) {
+		errx(1, "invalid argument to --%s: %s", option, str);
+	}
+	return ret;
+}
+
 /** @brief Parse all given file names into many matrices.
  *
  * @param argv - argv
@@ -300,3 +529,207 @@ std::vector<matrix> parse(const std::string &file_name)
 
 	return matrices;
 }
+
+/** @brief The contents of a file. Regular files are mapped into memory, so
+ * that pages which are never touched are never read. Anything else, such as
+ * stdin, is read into a buffer.
+ */
+class file_contents
+{
+	std::string buffer = {};
+	void *mapping = MAP_FAILED;
+	size_t length = 0;
+
+  public:
+	explicit file_contents(const std::string &file_name)
+	{
+		if (file_name != "-") {
+			int fd = open(file_name.c_str(), O_RDONLY);
+			if (fd < 0) {
+				err(errno, "%s", file_name.c_str());
+			}
+
+			struct stat st;
+			if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+				length = st.st_size;
+				mapping = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+			}
+			close(fd);
+
+			if (mapping != MAP_FAILED) return;
+		}
+
+		std::ifstream file;
+		auto input = open_input(file_name, file);
+		buffer.assign(std::istreambuf_iterator<char>(*input),
+					  std::istreambuf_iterator<char>());
+		length = buffer.size();
+	}
+
+	~file_contents()
+	{
+		if (mapping != MAP_FAILED) munmap(mapping, length);
+	}
+
+	file_contents(const file_contents &) = delete;
+	file_contents &operator=(const file_contents &) = delete;
+
+	const char *begin() const noexcept
+	{
+		return mapping != MAP_FAILED ? static_cast<const char *>(mapping)
+									 : buffer.data();
+	}
+
+	const char *end() const noexcept
+	{
+		return begin() + length;
+	}
+};
+
+/** @brief Advance past the current line and any following whitespace.
+ *
+ * @param first - Somewhere within the line.
+ * @param last - The end of the input.
+ * @returns the start of the next non-empty line.
+ */
+static const char *next_line(const char *first, const char *last)
+{
+	auto eol = static_cast<const char *>(memchr(first, '\n', last - first));
+	first = eol ? eol + 1 : last;
+	while (first != last && std::isspace(static_cast<unsigned char>(*first))) {
+		first++;
+	}
+	return first;
+}
+
+/** @brief Parse only selected rows and columns from all matrices in a file.
+ * The first pass over a matrix reads only the names, jumping from line to
+ * line. Then the selector decides which rows to keep, and the second pass
+ * parses only those rows, and within them only the selected columns.
+ *
+ * @param file_name - The file to read; "-" for stdin.
+ * @param select - Picks the indices to keep from the names of each matrix.
+ * @returns the selected submatrices.
+ */
+std::vector<matrix> parse_selected(const std::string &file_name,
+								   const name_selector &select)
+{
+	using boost::spirit::x3::double_;
+	using boost::spirit::x3::lit;
+	using boost::spirit::x3::space;
+
+	auto contents = file_contents{file_name};
+	const char *first = contents.begin(), *last = contents.end();
+
+	if (first == last) {
+		errx(1, "%s: empty file", file_name.c_str());
+	}
+
+	auto matrices = std::vector<matrix>{};
+
+	while (first != last) {
+		auto size = parse_size(file_name, first, last);
+
+		// the names point into the file contents
+		auto names = std::vector<std::string_view>{};
+		auto row_starts = std::vector<const char *>(size);
+		names.reserve(size);
+
+		// the first line determines the format, see parse_tolerant_internal()
+		row_starts[0] = first;
+		auto first_line = parse_line_spirit(file_name, first, last, size);
+		auto lower_triangle = first_line.second.size() < size;
+		auto diagonal_values = lower_triangle && first_line.second.size() == 1;
+		auto first_name_end = std::find_if(row_starts[0], last, [](char c) {
+			return std::isspace(static_cast<unsigned char>(c));
+		});
+		names.emplace_back(row_starts[0], first_name_end - row_starts[0]);
+
+		auto is_space = [](char c) {
+			return std::isspace(static_cast<unsigned char>(c));
+		};
+
+		// first pass: names only
+		for (size_t i = 1; i < size; i++) {
+			if (first == last) {
+				errx(1, "%s: parse error", file_name.c_str());
+			}
+			row_starts[i] = first;
+			auto name_end = std::find_if(first, last, is_space);
+			names.emplace_back(first, name_end - first);
+			first = next_line(name_end, last);
+		}
+
+		auto line_length = [&](size_t i) {
+			return lower_triangle ? i + size_t(diagonal_values) : size;
+		};
+
+		// skip the coverages; empty rows have no line of their own
+		if (boost::spirit::x3::parse(first, last,
+									 lit("Coverages:") >> *space)) {
+			for (size_t i = 0; i < size && first != last; i++) {
+				if (line_length(i) > 0) first = next_line(first, last);
+			}
+		}
+
+		auto table = name_table(names.begin(), names.end());
+		if (table.duplicate() != name_table::npos) {
+			auto duplicate = table[table.duplicate()];
+			errx(1, "%s: the name %.*s appears twice.", file_name.c_str(),
+				 int(duplicate.size()), duplicate.data());
+		}
+
+		auto selected = select(table);
+		auto new_size = selected.size();
+
+		// position of each column within the submatrix
+		auto position = std::vector<size_t>(size, size_t(-1));
+		size_t max_column = 0;
+		for (size_t p = 0; p < new_size; p++) {
+			position[selected[p]] = p;
+			max_column = std::max(max_column, selected[p]);
+		}
+
+		// second pass: selected rows and columns only
+		auto values = std::vector<double>(new_size * new_size);
+		for (size_t p = 0; p < new_size; p++) {
+			auto row = selected[p];
+			auto ptr = std::find_if(row_starts[row], last, is_space);
+			auto columns = std::min(line_length(row), max_column + 1);
+
+			for (size_t j = 0; j < columns; j++) {
+				while (ptr != last && (*ptr == ' ' || *ptr == '\t')) ptr++;
+				if (ptr == last || is_space(*ptr)) break;
+
+				auto token_end = std::find_if(ptr, last, is_space);
+				if (position[j] != size_t(-1)) {
+					auto &value = values[p * new_size + position[j]];
+					auto it = ptr;
+					if (!boost::spirit::x3::parse(it, token_end, double_,
+												  value) ||
+						it != token_end) {
+						errx(1, "%s: parse error", file_name.c_str());
+					}
+				}
+				ptr = token_end;
+			}
+		}
+
+		if (lower_triangle) {
+			// the upper triangle is missing; mirror from the later row
+			for (size_t p = 0; p < new_size; p++) {
+				for (size_t q = 0; q < new_size; q++) {
+					if (selected[q] > selected[p]) {
+						values[p * new_size + q] = values[q * new_size + p];
+					}
+				}
+			}
+		}
+
+		matrices.emplace_back(
+			std::make_shared<const name_table>(table, selected),
+			std::move(values));
+	}
+
+	return matrices;
+}
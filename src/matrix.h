@@ -16,45 +16,237 @@
 
 #pragma once
 
+#include <algorithm>
 #include <cassert>
+#include <cstdint>
 #include <err.h>
 #include <fstream>
+#include <functional>
 #include <iostream>
+#include <memory>
+#include <numeric>
 #include <regex>
+#include <stdexcept>
 #include <string>
+#include <string_view>
 #include <unistd.h>
-#include <unordered_map>
 #include <vector>
 // #include <optional>
 
-class matrix
+/** @brief An immutable list of names. All characters are kept in a single
+ * buffer, delimited by offsets, and a flat open-addressing index maps names
+ * back to their position. Matrices derived from one another share a table,
+ * instead of each holding their own copies of every name.
+ */
+class name_table
 {
   public:
 	using size_type = size_t;
+	static constexpr size_type npos = size_type(-1);
 
-  protected:
-	template <typename T>
-	auto make_index_map(const std::vector<T> &container)
-		-> std::unordered_map<T, size_type>
-	{
-		auto ret = std::unordered_map<T, size_type>{};
-		ret.reserve(container.size());
-		for (size_type i = 0; i < container.size(); ++i) {
-			ret[container[i]] = i;
+  private:
+	std::string arena = {};
+	/// Name i spans arena[offsets[i], offsets[i+1]).
+	std::vector<size_type> offsets = {0};
+	std::vector<size_t> hashes = {};
+	/// One plus the index of a name, or zero for an empty slot.
+	std::vector<uint32_t> slots = {};
+	size_type m_duplicate = npos;
+
+	/** @brief Build the index over all names. For repeated names only the
+	 * first occurrence is indexed.
+	 */
+	void build_index()
+	{
+		auto capacity = size_type{1};
+		while (capacity < 2 * size()) capacity <<= 1;
+		auto mask = capacity - 1;
+
+		slots.assign(capacity, 0);
+		hashes.resize(size());
+
+		for (size_type i = 0; i < size(); i++) {
+			auto name = (*this)[i];
+			hashes[i] = std::hash<std::string_view>{}(name);
+
+			auto slot = hashes[i] & mask;
+			for (; slots[slot] != 0; slot = (slot + 1) & mask) {
+				auto j = slots[slot] - 1;
+				if (hashes[j] == hashes[i] && (*this)[j] == name) break;
+			}
+
+			if (slots[slot] == 0) {
+				slots[slot] = uint32_t(i + 1);
+			} else if (m_duplicate == npos) {
+				m_duplicate = slots[slot] - 1;
+			} else {
+				m_duplicate = std::min<size_type>(m_duplicate, slots[slot] - 1);
+			}
 		}
-		return ret;
 	}
+
+  public:
+	/// Iterates over the names as string views.
+	class const_iterator
+	{
+		const name_table *table = nullptr;
+		size_type index = 0;
+
+	  public:
+		using iterator_category = std::forward_iterator_tag;
+		using value_type = std::string_view;
+		using difference_type = std::ptrdiff_t;
+		using pointer = const std::string_view *;
+		using reference = std::string_view;
+
+		const_iterator() = default;
+		const_iterator(const name_table *_table, size_type _index)
+			: table{_table}, index{_index}
+		{
+		}
+
+		std::string_view operator*() const noexcept
+		{
+			return (*table)[index];
+		}
+
+		const_iterator &operator++() noexcept
+		{
+			index++;
+			return *this;
+		}
+
+		const_iterator operator++(int) noexcept
+		{
+			auto ret = *this;
+			index++;
+			return ret;
+		}
+
+		bool operator==(const const_iterator &other) const noexcept
+		{
+			return index == other.index;
+		}
+
+		bool operator!=(const const_iterator &other) const noexcept
+		{
+			return index != other.index;
+		}
+	};
+
+	name_table()
+	{
+		build_index();
+	}
+
+	/** @brief Create a table from a list of names.
+	 *
+	 * @param first - An iterator to the names; anything convertible to a
+	 * string view.
+	 * @param last - An iterator past the names.
+	 */
+	template <typename ForwardIt>
+	name_table(ForwardIt first, ForwardIt last)
+	{
+		for (auto it = first; it != last; it++) {
+			arena += std::string_view{*it};
+			offsets.push_back(arena.size());
+		}
+		build_index();
+	}
+
+	explicit name_table(const std::vector<std::string> &names)
+		: name_table(names.begin(), names.end())
+	{
+	}
+
+	/** @brief Create a table from a subset of another one.
+	 *
+	 * @param other - The table to take names from.
+	 * @param indices - The names to take, in order.
+	 */
+	name_table(const name_table &other, const std::vector<size_type> &indices)
+	{
+		offsets.reserve(indices.size() + 1);
+		for (auto index : indices) {
+			arena += other[index];
+			offsets.push_back(arena.size());
+		}
+		build_index();
+	}
+
+	size_type size() const noexcept
+	{
+		return offsets.size() - 1;
+	}
+
+	bool empty() const noexcept
+	{
+		return size() == 0;
+	}
+
+	std::string_view operator[](size_type i) const noexcept
+	{
+		return std::string_view{arena}.substr(offsets[i],
+											   offsets[i + 1] - offsets[i]);
+	}
+
+	const_iterator begin() const noexcept
+	{
+		return const_iterator{this, 0};
+	}
+
+	const_iterator end() const noexcept
+	{
+		return const_iterator{this, size()};
+	}
+
+	/** @brief Find the position of a name.
+	 *
+	 * @param name - The name to look up.
+	 * @returns its (first) index, or npos.
+	 */
+	size_type find(std::string_view name) const noexcept
+	{
+		auto hash = std::hash<std::string_view>{}(name);
+		auto mask = slots.size() - 1;
+
+		for (auto slot = hash & mask; slots[slot] != 0;
+			 slot = (slot + 1) & mask) {
+			auto i = slots[slot] - 1;
+			if (hashes[i] == hash && (*this)[i] == name) return i;
+		}
+		return npos;
+	}
+
+	/** @brief Find a name that occurs more than once.
+	 *
+	 * @returns the index of its first occurrence, or npos.
+	 */
+	size_type duplicate() const noexcept
+	{
+		return m_duplicate;
+	}
+};
+
+class matrix
+{
+  public:
+	using size_type = size_t;
+
+  protected:
 	/// The size of the matrix
 	size_type size = 0;
-	/// A list of names (of sequences)
-	std::vector<std::string> names = {};
+	/// A list of names (of sequences), shared with copies of this matrix
+	std::shared_ptr<const name_table> names =
+		std::make_shared<const name_table>();
 	/// The matrix itself
 	std::vector<double> values = {};
 
-	std::unordered_map<std::string, size_t> name_map{};
-
 	bool m_has_coverages = false;
-	std::vector<double> coverages = {};
+	/// Coverages are symmetric, so only the lower triangle (including the
+	/// diagonal) is kept, in single precision.
+	std::vector<float> coverages = {};
 
   public:
 	matrix() = default;
@@ -66,36 +258,103 @@ class matrix
 	 * @param _values - The new values
 	 * @returns the new matrix
 	 */
-	matrix(std::vector<std::string> _names, std::vector<double> _values)
-		: size{_names.size()}, names{std::move(_names)}, values{std::move(
-															 _values)},
-		  name_map{make_index_map(names)}, m_has_coverages{false}, coverages{}
-
+	matrix(std::shared_ptr<const name_table> _names,
+		   std::vector<double> _values)
+		: size{_names->size()}, names{std::move(_names)},
+		  values{std::move(_values)}, m_has_coverages{false}, coverages{}
 	{
-		assert(size == names.size());
 		assert(size * size == values.size());
 	}
 
-	matrix(std::vector<std::string> _names, std::vector<double> _values,
-		   std::vector<double> _coverages)
-		: size{_names.size()}, names{std::move(_names)},
-		  values{std::move(_values)}, name_map{make_index_map(names)},
-		  m_has_coverages{true}, coverages{std::move(_coverages)}
+	matrix(const std::vector<std::string> &_names, std::vector<double> _values)
+		: matrix(std::make_shared<const name_table>(_names), std::move(_values))
+	{
+	}
 
+	/** @brief Create a new matrix with coverages.
+	 *
+	 * @param _names - The new set of names
+	 * @param _values - The new values
+	 * @param _coverages - The packed lower triangle of coverages, see
+	 * triangle_index().
+	 * @returns the new matrix
+	 */
+	matrix(std::shared_ptr<const name_table> _names,
+		   std::vector<double> _values, std::vector<float> _coverages)
+		: size{_names->size()}, names{std::move(_names)},
+		  values{std::move(_values)}, m_has_coverages{true},
+		  coverages{std::move(_coverages)}
 	{
-		assert(size == names.size());
 		assert(size * size == values.size());
-		assert(size * size == coverages.size());
+		assert(triangle_size(size) == coverages.size());
+	}
+
+	matrix(const std::vector<std::string> &_names, std::vector<double> _values,
+		   std::vector<float> _coverages)
+		: matrix(std::make_shared<const name_table>(_names), std::move(_values),
+				 std::move(_coverages))
+	{
+	}
+
+	/** @brief The number of cells in a packed lower triangle, including the
+	 * diagonal.
+	 */
+	static constexpr size_type triangle_size(size_type size) noexcept
+	{
+		return size * (size + 1) / 2;
+	}
+
+	/** @brief Position of the cell (i, j) within a packed lower triangle.
+	 * The order of i and j does not matter.
+	 */
+	static constexpr size_type triangle_index(size_type i,
+											  size_type j) noexcept
+	{
+		auto row = std::max(i, j);
+		auto col = std::min(i, j);
+		return row * (row + 1) / 2 + col;
+	}
+
+	/** @brief Check whether a name occurs more than once. This is found while
+	 * building the name index, so it is free.
+	 */
+	bool has_duplicate_names() const noexcept
+	{
+		return names->duplicate() != name_table::npos;
+	}
+
+	/** @brief Find a name that occurs more than once.
+	 *
+	 * @returns the first such name, or an empty view if all names are unique.
+	 */
+	std::string_view duplicate_name() const noexcept
+	{
+		auto index = names->duplicate();
+		return index != name_table::npos ? (*names)[index] : std::string_view{};
+	}
+
+	/** @brief Find the index of a name.
+	 *
+	 * @param name - The name to look up.
+	 * @returns the row (and column) index of the name.
+	 */
+	size_type index_of(std::string_view name) const
+	{
+		auto index = names->find(name);
+		if (index == name_table::npos) {
+			throw std::out_of_range("unknown name");
+		}
+		return index;
 	}
 
-	double &entry(const std::string &ni, const std::string &nj)
+	double &entry(std::string_view ni, std::string_view nj)
 	{
-		return entry(name_map.at(ni), name_map.at(nj));
+		return entry(index_of(ni), index_of(nj));
 	}
 
-	const double &entry(const std::string &ni, const std::string &nj) const
+	const double &entry(std::string_view ni, std::string_view nj) const
 	{
-		return entry(name_map.at(ni), name_map.at(nj));
+		return entry(index_of(ni), index_of(nj));
 	}
 
 	/** @brief Access an entry by coordinates.
@@ -173,11 +432,30 @@ class matrix
 	 *
 	 * @returns Returns a read-only reference of the names.
 	 */
-	auto get_names() const noexcept -> const std::vector<std::string> &
+	auto get_names() const noexcept -> const name_table &
+	{
+		return *names;
+	}
+
+	/** @brief Get the shared list of names, for derived matrices.
+	 *
+	 * @returns the name table.
+	 */
+	auto get_name_table() const noexcept -> std::shared_ptr<const name_table>
 	{
 		return names;
 	}
 
+	/** @brief Get a single name.
+	 *
+	 * @param i - the index
+	 * @returns a read-only reference to the name.
+	 */
+	auto name(size_type i) const noexcept -> std::string_view
+	{
+		return (*names)[i];
+	}
+
 	auto get_values() const noexcept -> const std::vector<double> &
 	{
 		return values;
@@ -188,28 +466,201 @@ class matrix
 		return m_has_coverages;
 	}
 
-	auto get_coverages() const -> const std::vector<double> &
+	/** @brief The packed lower triangle of coverages; empty if the matrix
+	 * has none.
+	 */
+	auto get_coverages() const noexcept -> const std::vector<float> &
 	{
-		if (!has_coverages()) throw "no coverages.";
 		return coverages;
 	}
 
-	double &cov_entry(size_type i, size_type j)
+	/** @brief Access the coverage of a cell. Check has_coverages() once
+	 * before, instead of on every access.
+	 *
+	 * @param i - The row.
+	 * @param j - The column.
+	 * @returns the coverage of the cell.
+	 */
+	double cov_entry(size_type i, size_type j) const noexcept
+	{
+		assert(has_coverages());
+		return coverages[triangle_index(i, j)];
+	}
+
+	// defined in matrix.cxx
+	std::string to_string() const;
+};
+
+/** @brief Translate a list of names into their indices within a matrix.
+ *
+ * @param self - The matrix to look the names up in.
+ * @param first - An iterator to a list of names.
+ * @param last - An iterator past the list of names.
+ * @returns the list of indices, in the order of the names.
+ */
+template <typename ForwardIt>
+std::vector<matrix::size_type>
+indices_of(const matrix &self, const ForwardIt first, const ForwardIt last)
+{
+	auto ret = std::vector<matrix::size_type>();
+	ret.reserve(std::distance(first, last));
+
+	for (auto it = first; it != last; it++) {
+		ret.push_back(self.index_of(*it));
+	}
+
+	return ret;
+}
+
+/** @brief Sample a distance matrix by indices. Row and column i of the new
+ * matrix are row and column indices[i] of the old one.
+ *
+ * @param self - The matrix to sample.
+ * @param indices - The indices to sample.
+ * @returns a new matrix with only the given rows and columns.
+ */
+inline matrix sample(const matrix &self,
+					 const std::vector<matrix::size_type> &indices)
+{
+	auto new_size = indices.size();
+	auto new_names =
+		std::make_shared<const name_table>(self.get_names(), indices);
+
+	auto new_values = std::vector<double>(new_size * new_size);
+	auto out = new_values.begin();
+
+	// gather every row
+	for (auto i : indices) {
+		auto row = self.row(i);
+		for (auto j : indices) {
+			*out++ = row[j];
+		}
+	}
+
+	return matrix{std::move(new_names), std::move(new_values)};
+}
+
+/** @brief A read-only view of a submatrix. Row and column i of the view are
+ * row and column indices[i] of the base matrix. Nothing is copied; the base
+ * matrix has to outlive the view.
+ */
+class matrix_view
+{
+  public:
+	using size_type = matrix::size_type;
+
+  protected:
+	const matrix *base = nullptr;
+	std::vector<size_type> indices = {};
+	/// true iff indices[i] == i for all i
+	bool contiguous = false;
+
+	static bool is_identity(const std::vector<size_type> &indices)
 	{
-		if (!has_coverages()) throw "no coverages.";
-		return coverages[i * size + j];
+		for (size_type i = 0; i < indices.size(); i++) {
+			if (indices[i] != i) return false;
+		}
+		return true;
 	}
 
-	const double &cov_entry(size_type i, size_type j) const
+  public:
+	matrix_view() = default;
+	matrix_view(const matrix &_base, std::vector<size_type> _indices)
+		: base{&_base}, indices{std::move(_indices)},
+		  contiguous{is_identity(indices)}
 	{
-		if (!has_coverages()) throw "no coverages.";
-		return coverages[i * size + j];
 	}
 
-	// defined in matrix.cxx
-	std::string to_string() const;
+	/** @brief Create a view of the whole matrix. */
+	explicit matrix_view(const matrix &_base)
+		: base{&_base}, indices(_base.get_size()), contiguous{true}
+	{
+		std::iota(indices.begin(), indices.end(), 0);
+	}
+
+	const double &entry(size_type i, size_type j) const
+	{
+		return base->entry(indices[i], indices[j]);
+	}
+
+	auto get_size() const noexcept
+	{
+		return indices.size();
+	}
+
+	auto name(size_type i) const noexcept -> std::string_view
+	{
+		return base->name(indices[i]);
+	}
+
+	/** @brief Get a whole row. If the view is contiguous, it is read in
+	 * place. Otherwise the entries are gathered into the buffer.
+	 *
+	 * @param i - the row index
+	 * @param buffer - space for at least get_size() values
+	 * @returns a pointer to the entries (i,0) to (i,get_size()-1).
+	 */
+	const double *row(size_type i, double *buffer) const
+	{
+		auto row = base->row(indices[i]);
+		if (contiguous) return &*row;
+
+		for (size_type j = 0; j < indices.size(); j++) {
+			buffer[j] = row[indices[j]];
+		}
+		return buffer;
+	}
+
+	/** @brief Get the entries left of the main diagonal of a row. If the
+	 * view is contiguous, they are read in place. Otherwise they are gathered
+	 * into the buffer.
+	 *
+	 * @param i - the row index
+	 * @param buffer - space for at least i values
+	 * @returns a pointer to the entries (i,0) to (i,i-1).
+	 */
+	const double *lower_row(size_type i, double *buffer) const
+	{
+		auto row = base->row(indices[i]);
+		if (contiguous) return &*row;
+
+		for (size_type j = 0; j < i; j++) {
+			buffer[j] = row[indices[j]];
+		}
+		return buffer;
+	}
+
+	auto get_base() const noexcept -> const matrix &
+	{
+		return *base;
+	}
+
+	auto get_indices() const noexcept -> const std::vector<size_type> &
+	{
+		return indices;
+	}
+
+	/** @brief Materialize the view into a new matrix. */
+	matrix to_matrix() const
+	{
+		return sample(*base, indices);
+	}
 };
 
+/** @brief Create a view of the submatrix for the given names.
+ *
+ * @param self - The base matrix.
+ * @param first - An iterator to a list of names.
+ * @param last - An iterator past the list of names.
+ * @returns a view with only the names specified in the list.
+ */
+template <typename ForwardIt>
+matrix_view sample_view(const matrix &self, const ForwardIt first,
+						const ForwardIt last)
+{
+	return matrix_view(self, indices_of(self, first, last));
+}
+
 /** @brief Sample a distance matrix. Only the names given by the input list are
  * included in the new submatrix. The implied order of names from the index list
  * is preserved.
@@ -222,29 +673,66 @@ class matrix
 template <typename ForwardIt>
 matrix sample2(const matrix &self, const ForwardIt first, const ForwardIt last)
 {
-	auto new_size = distance(first, last);
-	auto new_names = std::vector<std::string>(first, last);
-
-	auto new_values = std::vector<double>(new_size * new_size);
-	auto ret = matrix{new_names, new_values};
-
-	// Copy and rearrange the values
-	for (auto it = first; it != last; it++) {
-		auto name1 = *it;
-		for (auto jk = first; jk != last; jk++) {
-			auto name2 = *jk;
-			ret.entry(name1, name2) = self.entry(name1, name2);
-		}
-	}
-
-	return ret;
+	return sample(self, indices_of(self, first, last));
 }
 
 // defined in matrix.cxx
 std::vector<matrix> parse(const std::string &file_name);
 std::vector<matrix> parse_all(const char *const *);
 std::vector<matrix> parse_all(const std::vector<std::string> &file_names);
-std::string format(const matrix &, char, const char *, bool);
+size_t parse_count(const char *str, const char *option);
+/** @brief Choose rows and columns of a matrix by their names. Returns the
+ * indices to keep, in the order they should appear in.
+ */
+using name_selector =
+	std::function<std::vector<matrix::size_type>(const name_table &)>;
+std::vector<matrix> parse_selected(const std::string &file_name,
+								   const name_selector &select);
+void format_row(std::string &, std::string_view, const double *, size_t,
+				char = ' ', const char * = "%9.3e", bool = false);
+std::string format(const matrix &, char = ' ', const char * = "%9.3e",
+				   bool = false);
+std::string format(const matrix_view &, char = ' ', const char * = "%9.3e",
+				   bool = false);
+
+/** @brief Read distance matrices from a file row by row. This needs memory
+ * proportional to a single row, only.
+ */
+class row_reader
+{
+  public:
+	using size_type = matrix::size_type;
+
+  private:
+	struct impl;
+	std::unique_ptr<impl> pimpl;
+
+  public:
+	explicit row_reader(const std::string &file_name);
+	~row_reader();
+
+	/** @brief Advance to the next matrix in the file.
+	 *
+	 * @returns false iff there is none.
+	 */
+	bool next_matrix();
+
+	/** @brief Get the size of the current matrix.
+	 *
+	 * @returns The size.
+	 */
+	size_type get_size() const noexcept;
+
+	/** @brief Read the next row of the current matrix. In lower triangle
+	 * format the entries right of the main diagonal are missing. So only the
+	 * first i values of row i are guaranteed to be present.
+	 *
+	 * @param name - Set to the name of the row.
+	 * @param values - Set to the values of the row.
+	 * @returns false iff all rows have been read.
+	 */
+	bool next_row(std::string &name, std::vector<double> &values);
+};
 
 class square_iterator_helper
 {
@@ -336,8 +824,8 @@ template <class Matrix, class Helper>
 class matrix_iterator
 {
   private:
-	using my_double = typename std::conditional<std::is_const<Matrix>::value,
-												const double, double>::type;
+	using my_double = std::remove_reference_t<decltype(
+		std::declval<Matrix &>().entry(size_t(0), size_t(0)))>;
 
   public:
 	using my_type = matrix_iterator<Matrix, Helper>;
@@ -519,16 +1007,26 @@ auto lower_triangle(T &self)
 	return lower_triangle_agg<T>(self);
 }
 
-inline std::vector<std::string>
-common_names(std::vector<std::string> self_names,
-			 std::vector<std::string> other_names)
+/** @brief Find the names two lists have in common.
+ *
+ * @param self_names - One list of names.
+ * @param other_names - The other list.
+ * @returns the common names, sorted.
+ */
+template <typename NamesA, typename NamesB>
+std::vector<std::string> common_names(const NamesA &self_names,
+									  const NamesB &other_names)
 {
 	auto ret = std::vector<std::string>{};
-
-	std::sort(self_names.begin(), self_names.end());
-	std::sort(other_names.begin(), other_names.end());
-	std::set_intersection(self_names.begin(), self_names.end(),
-						  other_names.begin(), other_names.end(),
+	auto self_sorted =
+		std::vector<std::string>(std::begin(self_names), std::end(self_names));
+	auto other_sorted = std::vector<std::string>(std::begin(other_names),
+												 std::end(other_names));
+
+	std::sort(self_sorted.begin(), self_sorted.end());
+	std::sort(other_sorted.begin(), other_sorted.end());
+	std::set_intersection(self_sorted.begin(), self_sorted.end(),
+						  other_sorted.begin(), other_sorted.end(),
 						  std::back_inserter(ret));
 
 	return ret;
@@ -21,6 +21,7 @@
  */
 
 #include <cassert>
+#include <cstring>
 #include <getopt.h>
 #include <iostream>
 #include <numeric>